@@ -37,12 +37,48 @@ function(WRAP_STRING)
     set(${WRAP_STRING_VARIABLE} "${lines}" PARENT_SCOPE)
 endfunction()
 
+# Function to read a file as byte array definition followed by a std::string_view on it.
+# Parameters
+#   FILE            - The path of the file to read.
+#   VARIABLE_NAME   - The name of the string_view, the array is named ${VARIABLE_NAME}_ARRAY.
+#   OUTPUT          - The name of the CMake variable the definitions are appended to.
+#   NULL_TERMINATE  - If specified a null byte(zero) is appended to the array but not counted in the string_view.
+function(FILE_TO_ARRAY)
+    set(options NULL_TERMINATE)
+    set(oneValueArgs FILE VARIABLE_NAME OUTPUT)
+    cmake_parse_arguments(FILE_TO_ARRAY "${options}" "${oneValueArgs}" "" ${ARGN})
+
+    # reads source file contents as hex string
+    file(READ ${FILE_TO_ARRAY_FILE} hexString HEX)
+    string(LENGTH ${hexString} hexStringLength)
+
+    # appends null byte if asked
+    if(FILE_TO_ARRAY_NULL_TERMINATE)
+        set(hexString "${hexString}00")
+    endif()
+
+    # wraps the hex string into multiple lines at column 32(i.e. 16 bytes per line)
+    wrap_string(VARIABLE hexString AT_COLUMN 32)
+    math(EXPR arraySize "${hexStringLength} / 2")
+
+    # adds '0x' prefix and comma suffix before and after every byte respectively
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1, " arrayValues ${hexString})
+    # removes trailing comma
+    string(REGEX REPLACE ", $" "" arrayValues ${arrayValues})
+
+    # declares byte array and the length variables
+    set(arrayDefinition "constexpr char ${FILE_TO_ARRAY_VARIABLE_NAME}_ARRAY[]{ ${arrayValues} };")
+    set(${FILE_TO_ARRAY_OUTPUT} "${${FILE_TO_ARRAY_OUTPUT}}${arrayDefinition}\nconstexpr std::string_view ${FILE_TO_ARRAY_VARIABLE_NAME}{${FILE_TO_ARRAY_VARIABLE_NAME}_ARRAY, ${arraySize}};\n" PARENT_SCOPE)
+endfunction()
+
 # Function to embed contents of a file as byte array in C/C++ header file(.h). The header file
-# will contain a byte array and integer variable holding the size of the array.
+# will contain a byte array and a string_view on it, gzip and brotli compressed variants of the
+# file (empty string_views if the compression is not available or does not make the file smaller)
+# and an embedded_file combining all variants.
 # Parameters
 #   SOURCE_FILE     - The path of source file whose contents will be embedded in the header file.
-#   VARIABLE_NAME   - The name of the variable for the byte array. The string "_SIZE" will be append
-#                     to this name and will be used a variable name for size variable.
+#   VARIABLE_NAME   - The name of the string_view, the variants are named ${VARIABLE_NAME}_GZIP,
+#                     ${VARIABLE_NAME}_BR and the embedded_file ${VARIABLE_NAME}_FILE.
 #   HEADER_FILE     - The path of header file.
 #   APPEND          - If specified appends to the header file instead of overwriting it
 #   NULL_TERMINATE  - If specified a null byte(zero) will be append to the byte array. This will be
@@ -63,36 +99,58 @@ function(BIN2H)
         message("Failed to minify ${BIN2H_SOURCE_FILE}")
         file(COPY_FILE ${BIN2H_SOURCE_FILE} ${minified_file})
     endif()
-
-    # reads source file contents as hex string
-    file(READ ${minified_file} hexString HEX)
-    string(LENGTH ${hexString} hexStringLength)
-
-    # appends null byte if asked
-    if(BIN2H_NULL_TERMINATE)
-        set(hexString "${hexString}00")
+    file(SIZE ${minified_file} identitySize)
+
+    # pre-compressed variants, gzip is built into cmake, brotli needs the brotli tool
+    set(gzip_file "${BIN2H_HEADER_FILE}.gzip.tmp")
+    file(REMOVE ${gzip_file})
+    file(ARCHIVE_CREATE OUTPUT ${gzip_file} PATHS ${minified_file} FORMAT raw COMPRESSION GZip COMPRESSION_LEVEL 9)
+    set(br_file "${BIN2H_HEADER_FILE}.br.tmp")
+    file(REMOVE ${br_file})
+    find_program(BROTLI brotli)
+    if (BROTLI)
+        execute_process(COMMAND ${BROTLI} -q 11 -f -o ${br_file} ${minified_file} RESULT_VARIABLE res)
+        if (NOT res EQUAL 0)
+            # a partially written file must not be embedded
+            message("Failed to compress ${BIN2H_SOURCE_FILE} with brotli, it is embedded without brotli variant")
+            file(REMOVE ${br_file})
+        endif()
+    else()
+        message("brotli not found, ${BIN2H_SOURCE_FILE} is embedded without brotli variant")
     endif()
 
-    # wraps the hex string into multiple lines at column 32(i.e. 16 bytes per line)
-    wrap_string(VARIABLE hexString AT_COLUMN 32)
-    math(EXPR arraySize "${hexStringLength} / 2")
-
-    # adds '0x' prefix and comma suffix before and after every byte respectively
-    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1, " arrayValues ${hexString})
-    # removes trailing comma
-    string(REGEX REPLACE ", $" "" arrayValues ${arrayValues})
-
     # converts the variable name into proper C identifier
     string(MAKE_C_IDENTIFIER "${BIN2H_VARIABLE_NAME}" BIN2H_VARIABLE_NAME)
     string(TOUPPER "${BIN2H_VARIABLE_NAME}" BIN2H_VARIABLE_NAME)
 
-    # declares byte array and the length variables
-    set(arrayDefinition "constexpr char ${BIN2H_VARIABLE_NAME}_ARRAY[]{ ${arrayValues} };")
+    if(BIN2H_NULL_TERMINATE)
+        file_to_array(FILE ${minified_file} VARIABLE_NAME ${BIN2H_VARIABLE_NAME} OUTPUT definitions NULL_TERMINATE)
+    else()
+        file_to_array(FILE ${minified_file} VARIABLE_NAME ${BIN2H_VARIABLE_NAME} OUTPUT definitions)
+    endif()
+    set(sizes "${identitySize}")
+    foreach(variant GZIP BR)
+        string(TOLOWER ${variant} ending)
+        set(variant_file "${BIN2H_HEADER_FILE}.${ending}.tmp")
+        set(variantSize 0)
+        if (EXISTS ${variant_file})
+            file(SIZE ${variant_file} variantSize)
+        endif()
+        if (variantSize GREATER 0 AND variantSize LESS identitySize)
+            file_to_array(FILE ${variant_file} VARIABLE_NAME ${BIN2H_VARIABLE_NAME}_${variant} OUTPUT definitions)
+            set(sizes "${sizes}, ${ending} ${variantSize}")
+        else()
+            set(definitions "${definitions}constexpr std::string_view ${BIN2H_VARIABLE_NAME}_${variant}{};\n")
+        endif()
+    endforeach()
+    set(definitions "${definitions}constexpr embedded_file ${BIN2H_VARIABLE_NAME}_FILE{${BIN2H_VARIABLE_NAME}, ${BIN2H_VARIABLE_NAME}_GZIP, ${BIN2H_VARIABLE_NAME}_BR};\n")
+    message("Embedded ${BIN2H_SOURCE_FILE} bytes: identity ${sizes}")
+    file(REMOVE ${minified_file} ${gzip_file} ${br_file})
 
     if(BIN2H_APPEND)
-        file(APPEND ${BIN2H_HEADER_FILE} "${arrayDefinition}\nconstexpr std::string_view ${BIN2H_VARIABLE_NAME}{${BIN2H_VARIABLE_NAME}_ARRAY, ${arraySize}};\n")
+        file(APPEND ${BIN2H_HEADER_FILE} "${definitions}")
     else()
-        file(WRITE ${BIN2H_HEADER_FILE} "#include <string_view>\n${arrayDefinition}\nconstexpr std::string_view ${BIN2H_VARIABLE_NAME}{${BIN2H_VARIABLE_NAME}_ARRAY, ${arraySize}};\n")
+        file(WRITE ${BIN2H_HEADER_FILE} "#include <string_view>\nstruct embedded_file { std::string_view identity; std::string_view gzip; std::string_view br; };\n${definitions}")
     endif()
 endfunction()
 
@@ -109,6 +109,7 @@
 #define configRUN_MULTIPLE_PRIORITIES           1
 #if configNUMBER_OF_CORES > 1
 #define configUSE_CORE_AFFINITY                 1
+#define configTIMER_SERVICE_TASK_CORE_AFFINITY  ( 1 << 0 ) // keep the timer task on the networking core
 #endif
 #define configUSE_PASSIVE_IDLE_HOOK             0
 
@@ -4,10 +4,15 @@
 #define VEBUS_RS485_TX_PIN 0
 #define VEBUS_RS485_RX_PIN 1
 #define VEBUS_RS485_EN_PIN 2
+#define VEBUS_RS485_RX_POLL_US 250
 #define VEBUS_MAX_BUFFER_SIZE 128
-#define VEBUS_MAX_RECEIVE_BUFFER 16
+#define VEBUS_DEVICE_COUNT 1 // units on the bus, eg. 3 for a three phase system
 #define VEBUS_FIFO_SIZE 16
+#define VEBUS_MAX_POLL_ENTRIES 16
 #define VEBUS_RESPONSE_TIMEOUT 10000
 #define VEBUS_MAX_RESEND 3
-#define VEBUS_MAX_SEM_DELAY pdMS_TO_TICKS(3)
+#define VEBUS_WRITE_KEEPALIVE_MS 20000
+#define VEBUS_TASK_CORE 1 // receive, decode and send run on this core, networking and flash on the other one
+#define VEBUS_TASK_PRIORITY 10
+#define VEBUS_SYNC_SEND_WINDOW_US 2000 // a request sent later after the sync frame counts as missed sync
 
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "seqlock.h"
+
+/**
+ * @brief Wakes the control task on events (new setpoint, new dc data, changed settings) instead of a fixed period
+ * and measures the latency from such an event until the multiplus acknowledged the resulting power setpoint.
+ * trigger() can be called from any task, the latency is written only from the VEBus communication task.
+ */
+struct control_loop {
+	struct latency {
+		uint32_t last_us;
+		uint32_t max_us;
+		uint64_t sum_us;
+		uint32_t count;
+	};
+
+	TaskHandle_t task{};
+	std::atomic<uint32_t> trigger_us{};	// time of the oldest not yet handled event, 0 if none
+	float trigger_value{};			// value of the last trigger_on_change() which triggered, only used by its single caller
+	latency _latency{};			// working copy of the VEBus communication task
+	seqlock<latency> latency_snapshot{};
+
+	static control_loop& Default() {
+		static control_loop c{};
+		return c;
+	}
+
+	void trigger() {
+		if (!trigger_us.load(std::memory_order_relaxed))
+			trigger_us.store(time_us_32() | 1, std::memory_order_relaxed); // | 1 to never store 0
+		if (task)
+			xTaskNotifyGive(task);
+	}
+	/** @brief Triggers only if value moved at least deadband away from the value of the last triggering call */
+	void trigger_on_change(float value, float deadband) {
+		if (std::abs(value - trigger_value) < deadband)
+			return;
+		trigger_value = value;
+		trigger();
+	}
+	/** @brief Returns the time of the event which woke the control task and resets it, 0 on a periodic wakeup */
+	uint32_t take_trigger() {
+		uint32_t t = trigger_us.load(std::memory_order_relaxed);
+		trigger_us.store(0, std::memory_order_relaxed);
+		return t;
+	}
+	/** @brief Completion callback of the power write, user holds the trigger time */
+	static void on_setpoint_acknowledged(bool success, void *user) {
+		if (!success)
+			return;
+		control_loop &c = Default();
+		uint32_t d = time_us_32() - uint32_t(uintptr_t(user));
+		c._latency.last_us = d;
+		c._latency.max_us = std::max(c._latency.max_us, d);
+		c._latency.sum_us += d;
+		c._latency.count++;
+		c.latency_snapshot.store(c._latency);
+	}
+	latency get_latency() const { return latency_snapshot.peek(); }
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "seqlock.h"
+#include "VEBusConfig.h"
+
+/** @brief Energy and charge counters, pos and neg count the two flow directions separately and are always positive */
+struct energy_totals {
+	struct pair {
+		uint64_t pos;
+		uint64_t neg;
+	};
+	pair dc_mj;	// milli joule, pos: charging the battery, neg: discharging
+	pair dc_mc;	// milli coulomb (mAs), same directions as dc_mj
+	// the ac info frames only carry rms voltage and current, so the ac side is apparent energy (V*A*s).
+	// Counted per device of the cluster, index 0 is the master
+	std::array<pair, VEBUS_DEVICE_COUNT> ac_in_mvas;	// milli VAs, pos: taken from the mains, neg: fed into the mains
+	std::array<pair, VEBUS_DEVICE_COUNT> ac_out_mvas;	// milli VAs, pos: supplied to the loads, neg: fed back into the ac output
+	uint32_t version;	// increased on every change of the layout, stored records with another version are dropped
+
+	static constexpr uint32_t VERSION{2};
+	/** @brief Sum over all devices */
+	static constexpr pair total(const std::array<pair, VEBUS_DEVICE_COUNT> &devices) {
+		pair sum{};
+		for (const pair &p: devices) {
+			sum.pos += p.pos;
+			sum.neg += p.neg;
+		}
+		return sum;
+	}
+	static constexpr double wh(uint64_t mj) { return mj / 3600000.; }
+	static constexpr double ah(uint64_t mc) { return mc / 3600000.; }
+	static constexpr double vah(uint64_t mvas) { return mvas / 3600000.; }
+};
+
+/**
+ * @brief Trapezoidal integration of a signal given in milli units, the positive and negative area are accumulated separately
+ * (a segment crossing zero is split at the crossing). Sub milli unit seconds are carried over in a remainder so no
+ * energy is lost at high sample rates. Gaps longer than MAX_GAP_US are not bridged.
+ */
+struct trapezoid_integrator {
+	static constexpr uint64_t MAX_GAP_US{2000000};
+
+	int32_t last{};
+	uint64_t last_us{};
+	bool started{};
+	int64_t rest_pos{};	// milli unit microseconds not yet added to the total
+	int64_t rest_neg{};
+
+	void add(int32_t value, uint64_t now_us, energy_totals::pair &total) {
+		uint64_t dt = now_us - last_us;
+		if (started && dt <= MAX_GAP_US && now_us > last_us) {
+			int64_t a = last, b = value;
+			int64_t pos{}, neg{};
+			if ((a >= 0) == (b >= 0)) {
+				(a >= 0 ? pos: neg) = (a + b) * int64_t(dt) / 2;
+			} else { // split at the zero crossing
+				int64_t t0 = a * int64_t(dt) / (a - b);
+				(a >= 0 ? pos: neg) = a * t0 / 2;
+				(a >= 0 ? neg: pos) = b * (int64_t(dt) - t0) / 2;
+			}
+			rest_pos += pos;
+			rest_neg -= neg;
+			total.pos += rest_pos / 1000000;
+			total.neg += rest_neg / 1000000;
+			rest_pos %= 1000000;
+			rest_neg %= 1000000;
+		}
+		last = value;
+		last_us = now_us;
+		started = true;
+	}
+};
+
+/**
+ * @brief Integrates the dc measurements of the shared battery and the ac measurements of each device at the rate the info frames arrive.
+ * The add_* functions and publish() must be called from a single writer (the VEBus communication task),
+ * get() can be called from any task.
+ */
+struct energy_counter {
+	energy_totals totals{.dc_mj{}, .dc_mc{}, .ac_in_mvas{}, .ac_out_mvas{}, .version = energy_totals::VERSION};
+	trapezoid_integrator dc_power{};
+	trapezoid_integrator dc_current{};
+	std::array<trapezoid_integrator, VEBUS_DEVICE_COUNT> ac_in{};
+	std::array<trapezoid_integrator, VEBUS_DEVICE_COUNT> ac_out{};
+	seqlock<energy_totals> snapshot{};
+
+	energy_counter() { snapshot.store(totals); }
+
+	/** @brief current positive when charging the battery */
+	void add_dc(uint64_t now_us, float voltage, float current) {
+		dc_power.add(int32_t(voltage * current * 1000), now_us, totals.dc_mj);
+		dc_current.add(int32_t(current * 1000), now_us, totals.dc_mc);
+	}
+	/** @brief apparent power in VA, positive in the direction of the pos counters */
+	void add_ac(uint8_t device, uint64_t now_us, float in_va, float out_va) {
+		if (device >= VEBUS_DEVICE_COUNT)
+			return;
+		ac_in[device].add(int32_t(in_va * 1000), now_us, totals.ac_in_mvas[device]);
+		ac_out[device].add(int32_t(out_va * 1000), now_us, totals.ac_out_mvas[device]);
+	}
+	/** @brief Continues counting from stored totals, must be called before the first add_* call */
+	void restore(const energy_totals &t) {
+		if (t.version != energy_totals::VERSION)
+			return;
+		totals = t;
+		snapshot.store(totals);
+	}
+	void publish() { snapshot.store(totals); }
+	energy_totals get() const { return snapshot.peek(); }
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+enum history_channel: uint8_t {
+	HISTORY_BAT_V,	// 0.01 V
+	HISTORY_BAT_A,	// 0.1 A
+	HISTORY_AC_W,	// 1 W, mains side of the whole cluster
+	HISTORY_CHANNELS
+};
+constexpr std::array<std::string_view, HISTORY_CHANNELS> HISTORY_CHANNEL_NAMES{"bat_v", "bat_a", "ac_w"};
+constexpr std::array<float, HISTORY_CHANNELS> HISTORY_CHANNEL_SCALES{100, 10, 1}; // fixed point = value * scale
+
+struct history_sample {
+	static constexpr int16_t INVALID{std::numeric_limits<int16_t>::min()};
+	std::array<int16_t, HISTORY_CHANNELS> min{};
+	std::array<int16_t, HISTORY_CHANNELS> max{};
+	std::array<int16_t, HISTORY_CHANNELS> mean{INVALID}; // only the first channel marks an invalid sample
+
+	bool valid() const { return mean[0] != INVALID; }
+	static int16_t to_fixed(float v, history_channel c) {
+		return int16_t(std::clamp<float>(std::round(v * HISTORY_CHANNEL_SCALES[c]), INVALID + 1, std::numeric_limits<int16_t>::max()));
+	}
+};
+
+/**
+ * @brief Prediction state shared by encoder and decoder, the mean and the distances of min and max to the mean
+ * of the last valid sample per channel. Values are predicted to stay the same, only the int16 wrapping
+ * difference to the prediction is stored.
+ */
+struct history_prediction {
+	static constexpr int VALUES{3 * HISTORY_CHANNELS};
+	std::array<int16_t, VALUES> v{};
+
+	static std::array<int16_t, VALUES> values(const history_sample &s) {
+		std::array<int16_t, VALUES> r;
+		for (int c = 0; c < HISTORY_CHANNELS; ++c) {
+			r[3 * c] = s.mean[c];
+			r[3 * c + 1] = int16_t(s.mean[c] - s.min[c]);
+			r[3 * c + 2] = int16_t(s.max[c] - s.mean[c]);
+		}
+		return r;
+	}
+	history_sample sample() const {
+		history_sample s;
+		for (int c = 0; c < HISTORY_CHANNELS; ++c) {
+			s.mean[c] = v[3 * c];
+			s.min[c] = int16_t(v[3 * c] - v[3 * c + 1]);
+			s.max[c] = int16_t(v[3 * c] + v[3 * c + 2]);
+		}
+		return s;
+	}
+};
+
+/**
+ * @brief Compressed block of consecutive history samples, the time of a sample is first_start + index * resolution.
+ * Bit stream per sample:
+ * 0 invalid sample | 1 followed by the difference to the prediction for each of the history_prediction::VALUES:
+ * 0 -> 0, 10 + 3 bit -> [-4, 3], 110 + 6 bit -> [-32, 31], 1110 + 10 bit -> [-512, 511], 1111 + 16 bit -> any
+ * Every block starts with a zero prediction, so blocks can be decoded independently and the oldest one dropped.
+ */
+struct history_block {
+	static constexpr int SIZE{128};
+
+	uint32_t first_start{};
+	uint16_t count{};
+	uint16_t bits{};
+	std::array<uint8_t, SIZE - 8> data{};
+
+	static constexpr int CAPACITY_BITS{8 * (SIZE - 8)};
+
+	static int diff_bits(int16_t d) {
+		if (d == 0) return 1;
+		if (d >= -4 && d <= 3) return 2 + 3;
+		if (d >= -32 && d <= 31) return 3 + 6;
+		if (d >= -512 && d <= 511) return 4 + 10;
+		return 4 + 16;
+	}
+	static int sample_bits(const history_sample &s, const history_prediction &p) {
+		if (!s.valid())
+			return 1;
+		int n{1};
+		auto vals = history_prediction::values(s);
+		for (int i = 0; i < history_prediction::VALUES; ++i)
+			n += diff_bits(int16_t(vals[i] - p.v[i]));
+		return n;
+	}
+
+	/** @brief Appends the sample and updates the prediction, false if the block is full */
+	bool push(const history_sample &s, history_prediction &p) {
+		if (bits + sample_bits(s, p) > CAPACITY_BITS)
+			return false;
+		++count;
+		put(s.valid(), 1);
+		if (!s.valid())
+			return true;
+		auto vals = history_prediction::values(s);
+		for (int i = 0; i < history_prediction::VALUES; ++i) {
+			int16_t d = int16_t(vals[i] - p.v[i]);
+			if (d == 0) put(0b0, 1);
+			else if (d >= -4 && d <= 3) { put(0b10, 2); put(uint16_t(d), 3); }
+			else if (d >= -32 && d <= 31) { put(0b110, 3); put(uint16_t(d), 6); }
+			else if (d >= -512 && d <= 511) { put(0b1110, 4); put(uint16_t(d), 10); }
+			else { put(0b1111, 4); put(uint16_t(d), 16); }
+		}
+		p.v = vals;
+		return true;
+	}
+
+	/*INTERNAL*/ void put(uint32_t v, int n) {
+		for (int i = n - 1; i >= 0; --i, ++bits) {
+			uint8_t &byte = data[bits / 8];
+			uint8_t mask = 0x80 >> (bits % 8);
+			byte = (v >> i) & 1 ? byte | mask: byte & ~mask;
+		}
+	}
+	/*INTERNAL*/ uint32_t get(uint16_t &pos, int n) const {
+		uint32_t v{};
+		for (int i = 0; i < n; ++i, ++pos)
+			v = (v << 1) | ((data[pos / 8] >> (7 - pos % 8)) & 1);
+		return v;
+	}
+};
+
+/** @brief Streaming decoder, yields the samples of a block one by one without a decode buffer */
+struct history_block_reader {
+	static constexpr std::array<int, 5> VALUE_BITS{0, 3, 6, 10, 16}; // by the number of leading one bits
+
+	const history_block &block;
+	uint16_t pos{};
+	uint16_t idx{};
+	history_prediction p{};
+
+	uint32_t start(uint32_t resolution_s) const { return block.first_start + idx * resolution_s; }
+	bool done() const { return idx >= block.count; }
+
+	/** @brief Decodes the next sample, must not be called when done() */
+	history_sample next() {
+		++idx;
+		if (!block.get(pos, 1))
+			return history_sample{};
+		for (int i = 0; i < history_prediction::VALUES; ++i) {
+			int prefix{};
+			while (prefix < 4 && block.get(pos, 1))
+				++prefix;
+			int16_t d{};
+			if (prefix)
+				d = sign_extend(block.get(pos, VALUE_BITS[prefix]), VALUE_BITS[prefix]);
+			p.v[i] = int16_t(p.v[i] + d);
+		}
+		return p.sample();
+	}
+	static int16_t sign_extend(uint32_t v, int bits) { return int16_t(v << (32 - bits) >> 16) >> (16 - bits); }
+};
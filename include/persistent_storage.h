@@ -1,6 +1,8 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
 #include <span>
 
 #include "pico/flash.h"
@@ -182,3 +184,94 @@ struct persistent_storage {
 
 using persistent_storage_t = persistent_storage<persistent_storage_layout>;
 
+
+/**
+ * @brief Append only log for values that change often (eg. energy counters) in its own flash sectors directly below
+ * the persistent storage. Every append programs the next erased page with a new record, a sector is only erased
+ * when the log wraps into it, so a sector sees one erase per FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE appends and the
+ * records of the other sectors survive a power loss during the erase.
+ * Only a single log can exist as its position is fixed.
+ */
+template<typename T, uint32_t SECTORS = 2>
+struct persistent_log {
+	static_assert(SECTORS >= 2, "at least one sector has to keep the last record while another is erased");
+	static constexpr uint32_t end_offset{persistent_storage_t::begin_offset / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE};
+	static constexpr uint32_t begin_offset{end_offset - SECTORS * FLASH_SECTOR_SIZE};
+	static constexpr uint32_t PAGES{SECTORS * FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE};
+	static constexpr uint32_t PAGES_PER_SECTOR{FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE};
+	static constexpr uint32_t ERASED{0xffffffff};
+
+	struct record {
+		uint32_t seq;
+		T data;
+		uint32_t check;
+	};
+	static_assert(sizeof(record) <= FLASH_PAGE_SIZE);
+
+	uint32_t next_page{};
+	uint32_t next_seq{};
+	std::array<uint8_t, FLASH_PAGE_SIZE> _page_buffer{};
+
+	static persistent_log& Default() {
+		static persistent_log l{};
+		return l;
+	}
+
+	static uint32_t checksum(const record &r) {
+		// fnv-1a over everything but the checksum
+		uint32_t h{2166136261u};
+		const uint8_t *b = reinterpret_cast<const uint8_t*>(&r);
+		for (size_t i = 0; i < offsetof(record, check); ++i)
+			h = (h ^ b[i]) * 16777619u;
+		return h;
+	}
+	static const record& page(uint32_t p) { return *reinterpret_cast<const record*>(flash_begin + begin_offset + p * FLASH_PAGE_SIZE); }
+	static bool page_erased(uint32_t p) {
+		const char *b = flash_begin + begin_offset + p * FLASH_PAGE_SIZE;
+		return std::all_of(b, b + FLASH_PAGE_SIZE, [](char c) { return c == char(0xff); });
+	}
+
+	/** @brief Finds the newest valid record, also has to be called once before the first append() */
+	bool read(T &out) {
+		bool found{};
+		uint32_t newest{};
+		next_page = 0;
+		next_seq = 0;
+		for (uint32_t p = 0; p < PAGES; ++p) {
+			const record &r = page(p);
+			if (r.seq == ERASED || r.check != checksum(r) || (found && int32_t(r.seq - newest) < 0))
+				continue;
+			found = true;
+			newest = r.seq;
+			out = r.data;
+			next_page = (p + 1) % PAGES;
+			next_seq = r.seq + 1;
+		}
+		return found;
+	}
+
+	err_t append(const T &data) {
+		// the erase only uses the size of the source range
+		persistent_storage_t::_write_data write_data{
+			.src_start = reinterpret_cast<const char*>(_page_buffer.data()),
+			.src_end = reinterpret_cast<const char*>(_page_buffer.data()) + FLASH_SECTOR_SIZE,
+			.dst_offset = begin_offset + next_page / PAGES_PER_SECTOR * FLASH_SECTOR_SIZE};
+		if (next_page % PAGES_PER_SECTOR == 0 || !page_erased(next_page)) {
+			err_t res = flash_safe_execute(persistent_storage_t::_flash_erase, (void*)&write_data, 500);
+			if (res != PICO_OK)
+				return res;
+		}
+		record r{.seq = next_seq, .data = data, .check = 0};
+		r.check = checksum(r);
+		_page_buffer.fill(0xff);
+		memcpy(_page_buffer.data(), &r, sizeof(r));
+		write_data.src_end = write_data.src_start + FLASH_PAGE_SIZE;
+		write_data.dst_offset = begin_offset + next_page * FLASH_PAGE_SIZE;
+		err_t res = flash_safe_execute(persistent_storage_t::_flash_program, (void*)&write_data, 500);
+		if (res != PICO_OK)
+			return res;
+		next_page = (next_page + 1) % PAGES;
+		++next_seq;
+		return PICO_OK;
+	}
+};
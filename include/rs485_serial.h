@@ -2,10 +2,26 @@
 
 #include <hardware/uart.h>
 #include <hardware/gpio.h>
+#include <hardware/dma.h>
+#include <pico/time.h>
+#include <algorithm>
+#include <array>
 #include <functional>
+#include <span>
 #include "pico/cyw43_arch.h"
 
+/**
+ * @brief Half duplex rs485 serial connection.
+ * Receiving is done by a dma channel which drains the uart rx fifo into the circular
+ * rx_ring, so no bytes are lost if the reading task is not scheduled for a while.
+ * The reading task registers a callback which is called as soon as a frame delimiter was received
+ * and then parses the received bytes in place via rx_contiguous() and rx_consume().
+ */
 struct rs485_serial {
+	static constexpr uint RX_RING_BITS{8};
+	static constexpr uint32_t RX_RING_SIZE{1u << RX_RING_BITS};
+	static constexpr uint32_t RX_DMA_TRANSFERS{0x80000000}; // multiple of RX_RING_SIZE, re-armed when done (after ~18h at 256 kbaud)
+
 	struct rs485_info {
 		uart_inst_t *uart{uart0};
 		uint baudrate{256000};
@@ -15,9 +31,21 @@ struct rs485_serial {
 		int data_bits{8};
 		int stop_bits{1};
 		uart_parity_t parity{UART_PARITY_NONE};
+		int rx_poll_us{250}; // interval in which the receive ring is checked for a frame delimiter
 		static rs485_info Default() {return {};}
 	};
 	rs485_info info;
+	alignas(RX_RING_SIZE) std::array<uint8_t, RX_RING_SIZE> rx_ring{}; // dma ring, has to be aligned to its size
+	uint rx_dma_channel{};
+	uint32_t rx_base{}; // bytes written by already finished dma runs
+	uint32_t rx_tail{}; // bytes consumed by the reader
+	uint32_t rx_overruns{};
+	repeating_timer_t rx_poll_timer{};
+	alarm_pool_t *rx_poll_pool{}; // created on the core of the first register_on_frame_callback() call
+	uint32_t rx_poll_scanned{}; // bytes already checked for a delimiter by the poll timer
+	uint8_t frame_delimiter{};
+	irq_handler_t frame_cb{};
+
 	rs485_serial(const rs485_info &info = rs485_info::Default()): info{info} {
 		this->info.baudrate = uart_init(info.uart, info.baudrate);
 		gpio_set_function(info.tx_pin, GPIO_FUNC_UART);
@@ -29,18 +57,53 @@ struct rs485_serial {
 		uart_set_format(info.uart, info.data_bits, info.stop_bits, info.parity);
 		uart_set_hw_flow(info.uart, false, false); // disable UART flow control CTS/RTS
 		uart_set_fifo_enabled(info.uart, true); // enabling 32 byte fifo
+
+		rx_dma_channel = dma_claim_unused_channel(true);
+		dma_channel_config c = dma_channel_get_default_config(rx_dma_channel);
+		channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+		channel_config_set_read_increment(&c, false);
+		channel_config_set_write_increment(&c, true);
+		channel_config_set_ring(&c, true, RX_RING_BITS); // wrap the write address
+		channel_config_set_dreq(&c, uart_get_dreq(info.uart, false));
+		dma_channel_configure(rx_dma_channel, &c, rx_ring.data(), &uart_get_hw(info.uart)->dr, RX_DMA_TRANSFERS, true);
 	}
+	rs485_serial(const rs485_serial&) = delete; // the dma channel writes into this object
 
 	void tx_flush() const {
 		uart_tx_wait_blocking(info.uart);
 	}
 
-	bool rx_available() const {
-		return uart_is_readable(info.uart);
+	/** @brief Total amount of bytes received since startup (wraps around) */
+	uint32_t rx_head() const {
+		return rx_base + (RX_DMA_TRANSFERS - dma_channel_hw_addr(rx_dma_channel)->transfer_count);
+	}
+
+	/** @brief Amount of received bytes which were not yet read. If the reader was
+	  * too slow and the dma overwrote unread bytes, all pending bytes are dropped */
+	uint32_t rx_available() {
+		if (!dma_channel_is_busy(rx_dma_channel)) {
+			rx_base += RX_DMA_TRANSFERS;
+			dma_channel_set_trans_count(rx_dma_channel, RX_DMA_TRANSFERS, true);
+		}
+		uint32_t head = rx_head();
+		if (head - rx_tail > RX_RING_SIZE) {
+			++rx_overruns;
+			rx_tail = head;
+		}
+		return head - rx_tail;
+	}
+
+	/** @brief View onto the received but not yet consumed bytes up to the end of the ring, without copying.
+	  * Bytes behind the ring end are returned by the next call after rx_consume() */
+	std::span<uint8_t> rx_contiguous() {
+		uint32_t available = rx_available();
+		uint32_t start = rx_tail & (RX_RING_SIZE - 1);
+		return {rx_ring.data() + start, std::min(available, RX_RING_SIZE - start)};
 	}
 
-	char getc() const {
-		return uart_getc(info.uart);
+	/** @brief Drops size bytes from the receive ring without reading them */
+	void rx_consume(uint32_t size) {
+		rx_tail += std::min(size, rx_available());
 	}
 
 	void write(const uint8_t *data, size_t size) {
@@ -56,16 +119,29 @@ struct rs485_serial {
 		gpio_put(info.en_pin, 0);
 	}
 
-	void register_on_receive_callback(irq_handler_t cb) {
-		int uart_irq = info.uart == uart0 ? UART0_IRQ : UART1_IRQ;
-		irq_set_exclusive_handler(uart_irq, cb);
-		irq_set_enabled(uart_irq, true);
-		uart_set_irq_enables(uart0, true, false); // enable receive callback only after callback is set
+	/** @brief Registers a callback which is called from irq context each time a frame delimiter
+	  * was received. The receive ring is checked every info.rx_poll_us microseconds.
+	  * The poll timer irq runs on the calling core, so the receiving task should be pinned to it */
+	void register_on_frame_callback(uint8_t delimiter, irq_handler_t cb) {
+		cancel_repeating_timer(&rx_poll_timer);
+		if (!rx_poll_pool)
+			rx_poll_pool = alarm_pool_create_with_unused_hardware_alarm(1);
+		frame_delimiter = delimiter;
+		frame_cb = cb;
+		rx_poll_scanned = rx_head();
+		alarm_pool_add_repeating_timer_us(rx_poll_pool, -info.rx_poll_us, _rx_poll, this, &rx_poll_timer);
 	}
 
-	void enable_receive_callback(bool enable) { 
-		int uart_irq = info.uart == uart0 ? UART0_IRQ : UART1_IRQ;
-		irq_set_enabled(uart_irq, enable);
+	/*INTERNAL*/ static bool _rx_poll(repeating_timer_t *timer) {
+		rs485_serial &serial = *static_cast<rs485_serial*>(timer->user_data);
+		uint32_t head = serial.rx_head();
+		if (head - serial.rx_poll_scanned > RX_RING_SIZE) // overrun or dma re-arm in progress, only check what is in the ring
+			serial.rx_poll_scanned = head - RX_RING_SIZE;
+		bool frame_received{};
+		for (; serial.rx_poll_scanned != head; ++serial.rx_poll_scanned)
+			frame_received |= serial.rx_ring[serial.rx_poll_scanned & (RX_RING_SIZE - 1)] == serial.frame_delimiter;
+		if (frame_received && serial.frame_cb)
+			serial.frame_cb();
+		return true;
 	}
 };
-
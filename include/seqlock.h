@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+/**
+ * @brief Single writer snapshot channel for small trivially copyable structs.
+ * The writer never blocks, readers retry until they copied a consistent snapshot.
+ * Only atomic loads and stores of 32 bit words are used as the rp2040 (cortex m0+) has no
+ * read-modify-write instructions, so the atomics stay lock free.
+ * Multiple readers are fine, there must only be a single writer.
+ */
+template<typename T>
+struct seqlock {
+	static_assert(std::is_trivially_copyable_v<T>);
+	static constexpr size_t WORDS{(sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t)};
+
+	std::atomic<uint32_t> seq{}; // odd while the writer is updating data
+	std::array<std::atomic<uint32_t>, WORDS> data{};
+	std::atomic<bool> new_data{};
+
+	/** @brief Publishes a new snapshot, must only be called by the single writer */
+	void store(const T &v) {
+		std::array<uint32_t, WORDS> words{};
+		std::memcpy(words.data(), &v, sizeof(T));
+		uint32_t s = seq.load(std::memory_order_relaxed);
+		seq.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < WORDS; ++i)
+			data[i].store(words[i], std::memory_order_relaxed);
+		seq.store(s + 2, std::memory_order_release);
+		new_data.store(true, std::memory_order_release);
+	}
+
+	/** @brief Copies the latest snapshot and resets the new data flag */
+	T load() {
+		new_data.store(false, std::memory_order_relaxed);
+		return peek();
+	}
+
+	/** @brief Copies the latest snapshot without touching the new data flag */
+	T peek() const {
+		std::array<uint32_t, WORDS> words;
+		for (int retries = 0;; ++retries) {
+			uint32_t s0 = seq.load(std::memory_order_acquire);
+			for (size_t i = 0; i < WORDS; ++i)
+				words[i] = data[i].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (!(s0 & 1) && s0 == seq.load(std::memory_order_relaxed))
+				break;
+			if (retries > 8) // writer got preempted on our core, let it finish
+				taskYIELD();
+		}
+		T v;
+		std::memcpy(&v, words.data(), sizeof(T));
+		return v;
+	}
+
+	bool has_new() const { return new_data.load(std::memory_order_acquire); }
+};
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <limits>
+#include <span>
 #include <string_view>
 #include <format>
 
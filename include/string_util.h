@@ -51,4 +51,17 @@ constexpr void skip_whitespace(std::string_view &content) {
 	content = content.substr(std::min(content.size(), content.find_first_not_of(" \t\n\v\r\f")));
 }
 
+/** @brief Case insensitive comparison for ascii strings, eg. http header names and tokens */
+constexpr bool iequals(std::string_view a, std::string_view b) {
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i) {
+		char x = a[i] >= 'A' && a[i] <= 'Z' ? a[i] - 'A' + 'a': a[i];
+		char y = b[i] >= 'A' && b[i] <= 'Z' ? b[i] - 'A' + 'a': b[i];
+		if (x != y)
+			return false;
+	}
+	return true;
+}
+
 constexpr bool is_quote(char c) { return c == '"' || c == '\''; }
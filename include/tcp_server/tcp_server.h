@@ -2,11 +2,14 @@
 
 #include <functional>
 #include <atomic>
+#include <cstdlib>
+#include <utility>
 
 #include "string_util.h"
 #include "static_types.h"
 
 #include "lwip/pbuf.h"
+#include "lwip/sys.h"
 #include "lwip/tcp.h"
 #include "log_storage.h"
 
@@ -24,12 +27,21 @@ constexpr std::string_view STATUS_BAD_REQUEST{"400 Bad Request"};
 constexpr std::string_view STATUS_UNAUTHORIZED{"401 Unauthorized"};
 constexpr std::string_view STATUS_FORBIDDEN{"403 Forbidden"};
 constexpr std::string_view STATUS_NOT_FOUND{"404 Not Found"};
+constexpr std::string_view STATUS_PAYLOAD_TOO_LARGE{"413 Payload Too Large"};
+constexpr std::string_view STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE{"431 Request Header Fields Too Large"};
 constexpr std::string_view STATUS_INTERNAL_SERVER_ERROR{"500 Internal Server Error"};
+constexpr std::string_view STATUS_SERVICE_UNAVAILABLE{"503 Service Unavailable"};
 
 struct EndpointFlags{
 	bool path_match: 1 {true}; // path for endpoint has to match, not only 
 };
 
+/** @brief Handle of a response which is sent later via tcp_server::complete_deferred(), see message_buffer::res_defer() */
+struct deferred_response {
+	int connection{-1};
+	uint32_t generation{}; // changes when the connection slot is given to a new client
+};
+
 struct header {
 	std::string_view key;
 	std::string_view value;
@@ -39,19 +51,49 @@ struct headers {
 	static_vector<header, max_headers> headers{};
 	const header* begin() const { return headers.begin(); }
 	const header* end() const { return headers.end(); }
+	/** @brief header names are case insensitive */
 	std::string_view get_header(std::string_view key) const {
 		for (const auto &[k, value]: headers)
-		if (key == k)
+		if (iequals(key, k))
 			return value;
 		return {};
 	}
 };
 
+/** @brief true if coding is acceptable according to the value of an Accept-Encoding header, q=0 excludes a coding */
+constexpr bool accepts_encoding(std::string_view accept_encoding, std::string_view coding) {
+	while (!accept_encoding.empty()) {
+		size_t end = accept_encoding.find(',');
+		std::string_view item = accept_encoding.substr(0, end);
+		accept_encoding = end == std::string_view::npos ? std::string_view{}: accept_encoding.substr(end + 1);
+		skip_whitespace(item);
+		std::string_view name = item.substr(0, item.find_first_of("; \t"));
+		if (!iequals(name, coding) && name != "*")
+			continue;
+		size_t q = item.find("q=");
+		if (q == std::string_view::npos)
+			return true;
+		std::string_view weight = item.substr(q + 2);
+		weight = weight.substr(0, weight.find_first_of(" \t;"));
+		return weight.find_first_not_of("0.") != std::string_view::npos;
+	}
+	return false;
+}
+
 /** @brief Tcp server that serves text data according to path specification.
   * The returned content can be freely configured via callbacks via callbacks 
-  * @note The tcp server instantly discards any connection after the response was sent.*/
+  * @note Connections are kept alive (HTTP/1.1 persistent connections) until the client asks to close them,
+  * max_keep_alive_requests were answered or no request arrived for idle_timeout_s.
+  * Requests are parsed incrementally per connection, so they can span several tcp segments and pipelined
+  * requests are answered in order. The body length is taken from Content-Length, bodies which do not fit
+  * into the recieve buffer are answered with 413 unless the endpoint takes the body in chunks via body_callback.
+  * Static bodies (see message_buffer::res_set_static_body()) are sent by reference without a copy,
+  * following requests of the same connection are answered after such a body was queued completely.
+  * Endpoints which have to wait for data (eg. a VE.Bus response) defer their response via message_buffer::res_defer()
+  * instead of blocking the lwip context, following requests of the connection are answered after it was completed.*/
 template<int get_size, int post_size, int put_size = 0, int delete_size = 0, int max_path_length = 256, int max_headers = 32, int buf_size = 4096, int message_buffers = 8>
 struct tcp_server {
+	struct connection;
 	/**
 	 * @brief Struct with a full http frame for both sending and recieving.
 	 * The struct has only 1 member, the `buffer` which really holds information,
@@ -66,23 +108,27 @@ struct tcp_server {
 		std::string_view status{}; // status code followed by a space and a possibly empty reason string
 		headers<max_headers> headers_view{}; // actually only contains std::string views to underlying buffer
 		std::string_view body{};
+		std::string_view static_body{}; // response only, sent by reference after the buffer
 
 		struct tcp_pcb *tpcb{};
 		bool on_stream_out{};
+		bool keep_alive{}; // response only, adds the Connection header in res_set_status_line()
+		bool deferred{}; // response only, set by res_defer()
+		connection *client{}; // response only, connection the response is sent to
 
 		tcp_server *parent_server{};
 
 		// ------------------------------------------------------
 		// request functions
 		// ------------------------------------------------------
-		/** @brief update the headers_view and body view from this message_buffer 
-		 * @note used for reading/parsing a package*/
+		/** @brief update the request line and headers_view from this message_buffer 
+		 * @note used for reading/parsing a package, the body view is set by the server once the body is complete*/
 		void req_update_structured_views();
 
 		// ------------------------------------------------------
 		// response functions
 		// ------------------------------------------------------
-		/** @brief Write the status line of the response message to the buffer
+		/** @brief Write the status line of the response message to the buffer followed by the Connection header
 		  * @note Resets previously set header and body values, but will give a warning
 		  * if done so */
 		void res_set_status_line(std::string_view http_version, std::string_view status);
@@ -95,13 +141,23 @@ struct tcp_server {
 		/** @brief writes the string_view the end of the backing buffer directly after the header section
 		  * and sets the internal body variable to exactly this string */
 		void res_write_body(std::string_view body = {});
-		void clear() { used = {}; buffer.clear(); method = {}; path = {}; http_version = {}; status = {}; headers_view.headers.clear(); body = {}; tpcb = {}; on_stream_out = {}; }
+		/** @brief ends the header section and sets body to be sent after the buffer without copying it
+		  * @note body has to stay valid until the connection is closed, eg. constexpr data in flash */
+		void res_set_static_body(std::string_view body) { res_write_body(); static_body = body; }
+		/** @brief Nothing is sent when the endpoint callback returns, the response is written and sent by
+		  * tcp_server::complete_deferred() with the returned handle. Every deferred response has to be completed,
+		  * the connection is not closed as idle meanwhile */
+		deferred_response res_defer() { deferred = true; return {int(client - parent_server->connections.data()), client->generation}; }
+		void clear() { used = {}; buffer.clear(); method = {}; path = {}; http_version = {}; status = {}; headers_view.headers.clear(); body = {}; static_body = {}; tpcb = {}; on_stream_out = {}; keep_alive = {}; deferred = {}; client = {}; }
 	};
 	using endpoint_callback = std::function<void(const message_buffer &request, message_buffer& response)>;
+	/** @brief Gets the body in consecutive chunks as they arrive, returning false rejects the request with 400 */
+	using body_callback_t = std::function<bool(const message_buffer &request, std::string_view chunk)>;
 	struct endpoint {
 		EndpointFlags flags;
 		std::array<char, 256> path;
 		endpoint_callback callback;
+		body_callback_t body_callback{}; // if set request.body is empty in callback, the body was given to body_callback before
 	};
 
 	int port{80};
@@ -110,23 +166,72 @@ struct tcp_server {
 	std::array<endpoint, post_size> post_endpoints{};
 	std::array<endpoint, put_size> put_endpoints{};
 	std::array<endpoint, delete_size> delete_endpoints{};
-	int poll_time_s{5};
+	int poll_time_s{5}; // interval of the idle check
+	int idle_timeout_s{15}; // connections without a request for this long are closed
+	int max_keep_alive_requests{100}; // the connection is closed with the response to this request
 
 	~tcp_server() { if(!closed) LogError("Tcp server not closed before destruction!"); };
 	err_t start();
 	err_t stop();
 	
+	/** @brief State of a client connection, given as arg to the lwip callbacks of the client pcb */
+	struct connection {
+		enum class parse_state: uint8_t { HEAD, BODY };
+
+		tcp_server *server{};
+		std::atomic<struct tcp_pcb*> pcb{};
+		uint32_t last_active_ms{};
+		int requests{};
+		uint32_t generation{}; // increased for every accepted client, invalidates deferred_response handles
+
+		// state of the request currently being recieved
+		message_buffer *request{}; // recieve buffer owned by this connection
+		const endpoint *target{}; // nullptr for the default endpoint
+		parse_state state{};
+		uint32_t scanned{}; // bytes of the head already searched for its end
+		uint32_t head_size{}; // request line and headers including the empty line
+		uint32_t content_length{};
+		uint32_t body_recieved{};
+
+		// sending state
+		std::string_view static_pending{}; // part of a static body not yet queued in lwip
+		bool close_after_send{};
+		struct pbuf *unprocessed{}; // recieved data waiting for static_pending to be queued or deferred to be completed
+		uint32_t unprocessed_offset{};
+		message_buffer *deferred{}; // send buffer reserved for a deferred response
+
+		bool request_complete() const { return state == parse_state::BODY && body_recieved == content_length; }
+		void reset_request() { request->clear(); target = {}; state = {}; scanned = {}; head_size = {}; content_length = {}; body_recieved = {}; }
+	};
+
 	struct tcp_pcb *server_pcb{};
 	bool closed{};
-	std::array<std::atomic<struct tcp_pcb*>, message_buffers> client_pcbs{}; // each client has 1 send and recieve buffer for itself
+	std::array<connection, message_buffers> connections{};
 	std::array<message_buffer, message_buffers> send_buffers{};
-	std::array<message_buffer, message_buffers> recieve_buffers{};
+	std::array<message_buffer, message_buffers> recieve_buffers{}; // recieve_buffers[i] belongs to connections[i]
 	int sent_len{};
 	int recv_len{};
 	int run_count{};
 
-	void process_request(uint32_t recieve_buffer_idx, struct tcp_pcb *client);
+	const endpoint* find_endpoint(std::string_view method, std::string_view path) const;
+	/** @brief Feeds the data of p from offset into the request of the client
+	  * @returns the number of consumed bytes */
+	uint32_t recieve(connection &client, const struct pbuf *p, uint32_t offset);
+	/** @brief Processes the unprocessed data of the client as far as possible */
+	void consume(connection &client);
+	/** @brief Answers the completely recieved request of the client, or rejects it with error_status.
+	  * Closes the connection if it is not kept alive */
+	void process_request(connection &client, std::string_view error_status = {});
+	/** @brief Sends the filled send_buffer to the client and releases the buffer */
+	void send_response(connection &client, message_buffer &send_buffer);
+	/** @brief Writes a response deferred by message_buffer::res_defer() via fill(message_buffer&) and sends it.
+	  * Has to be called from the lwip context (eg. an async_context worker)
+	  * @returns false if the client is gone meanwhile, fill is not called then */
+	template<typename F>
+	bool complete_deferred(deferred_response handle, F &&fill);
 	err_t send_data(std::string_view data, struct tcp_pcb *client);
+	/** @brief Queues as much of the static_pending data of the client as lwip accepts, continued from tcp_sent */
+	void send_static(connection &client);
 };
 
 // ------------------------------------------------------------------------------
@@ -136,8 +241,20 @@ struct tcp_server {
 namespace tcp_server_internal {
 
 /** @brief Contains all implementations regarding tcp server connections */
-constexpr static err_t clear_client_pcb(std::atomic<struct tcp_pcb*> &pcb) {
+template<typename connection>
+constexpr static err_t clear_client_pcb(connection &c) {
 	err_t err{ERR_OK};
+	struct tcp_pcb *pcb = c.pcb.exchange(nullptr);
+	if (!pcb)
+		return err;
+	c.static_pending = {};
+	c.close_after_send = false;
+	if (c.unprocessed)
+		pbuf_free(c.unprocessed);
+	c.unprocessed = nullptr;
+	if (c.deferred)
+		c.deferred->clear();
+	c.deferred = nullptr;
 	tcp_arg(pcb, NULL);
 	tcp_poll(pcb, NULL, 0);
 	tcp_sent(pcb, NULL);
@@ -149,7 +266,6 @@ constexpr static err_t clear_client_pcb(std::atomic<struct tcp_pcb*> &pcb) {
 		tcp_abort(pcb);
 		err = ERR_ABRT;
 	}
-	pcb = nullptr;
 	return err;
 
 }
@@ -163,63 +279,96 @@ constexpr static err_t tcp_server_result(void *arg, int status, struct tcp_pcb *
 	}
 	LogWarning("Server failed {}, deinitializing {}", status, client ? "one client": "no client");
 	err_t err = ERR_OK;
-	for (auto &pcb: server.client_pcbs) {
-		if (pcb == nullptr || (client && pcb != client))
+	for (auto &c: server.connections) {
+		if (c.pcb == nullptr || (client && c.pcb != client))
 			continue;
-		err = clear_client_pcb(pcb);
+		err = clear_client_pcb(c);
 	}
 	return err;
 }
 
+/** @brief Answers the requests that waited for a static body to be queued. They can be completely
+  * recieved already, with their pbuf freed, so the recieved request is checked as well */
+template<typename connection>
+constexpr static void resume_pipelined(connection &client) {
+	if (client.pcb && client.static_pending.empty() && !client.deferred && (client.unprocessed || client.request_complete()))
+		client.server->consume(client);
+}
+
 template template_args
 constexpr static err_t tcp_server_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+	using connection = tcp_server template_args_pure::connection;
+	if (!arg)
+		return ERR_OK;
+	connection &client = *static_cast<connection*>(arg);
+	client.last_active_ms = sys_now();
+	if (client.static_pending.empty())
+		return ERR_OK;
+	client.server->send_static(client);
+	resume_pipelined(client);
 	return ERR_OK;
 }
 
 
 template template_args
 constexpr static err_t tcp_server_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
-	if (!p || !arg) {
+	using connection = tcp_server template_args_pure::connection;
+	if (!arg) {
 		LogError("tcp_server_recv() failed");
-		return tcp_server_result template_args_pure(arg, -1, tpcb);
+		if (p)
+			pbuf_free(p);
+		return ERR_OK;
 	}
-	tcp_server template_args_pure& server = reinterpret_cast<tcp_server template_args_pure&>(*(char*)arg);
-	if (p->tot_len > buf_size)
-		LogError("Message too big, could not recieve");
-	else if (p->tot_len > 0) {
-		// Receive the buffer
-		int recieve_buffer{-1};
-		bool recieve_success{};
-		for (auto &buffer: server.recieve_buffers) {
-			++recieve_buffer;
-			if (buffer.used.exchange(true))
-				continue;
-			buffer.buffer.set_size(pbuf_copy_partial(p, buffer.buffer.data(), p->tot_len, 0));
-			server.process_request(recieve_buffer, tpcb);
-			recieve_success = true;
-			break;
-		}
-		if (!recieve_success)
-			LogError("Could not recieve message, no free recieve buffer");
+	connection &client = *static_cast<connection*>(arg);
+	tcp_server template_args_pure& server = *client.server;
+	if (!p) { // remote side closed the connection
+		LogInfo("Client closed the connection");
+		clear_client_pcb(client);
+		return ERR_OK;
 	}
-	pbuf_free(p);
+	client.last_active_ms = sys_now();
+	if (client.unprocessed)
+		pbuf_cat(client.unprocessed, p);
+	else
+		client.unprocessed = p;
+	server.consume(client);
 	return ERR_OK;
 }
 
 template template_args
 constexpr static err_t tcp_server_poll(void *arg, struct tcp_pcb *tpcb) {
-	// remove connections that are not anymore valid
-	LogInfo("tcp_server_poll_fn");
-	return tcp_server_result template_args_pure(arg, -1, tpcb); // on no response remove the client to free up space
+	// remove connections which were idle for too long
+	using connection = tcp_server template_args_pure::connection;
+	if (!arg)
+		return ERR_OK;
+	connection &client = *static_cast<connection*>(arg);
+	if (!client.static_pending.empty()) { // retry if the send queue was full
+		client.server->send_static(client);
+		resume_pipelined(client);
+	}
+	if (!client.pcb || client.deferred || sys_now() - client.last_active_ms < uint32_t(client.server->idle_timeout_s) * 1000)
+		return ERR_OK;
+	LogInfo("Closing idle connection");
+	clear_client_pcb(client);
+	return ERR_OK;
 }
 
 template template_args
 constexpr static void tcp_server_err(void *arg, err_t err) {
+	using connection = tcp_server template_args_pure::connection;
 	LogError("tcp_server_err {}", err);
-	if (err != ERR_ABRT) {
-		LogError("tcp_client_err_fn {}", err);
-		tcp_server_result template_args_pure(arg, err, nullptr);
-	}
+	// the pcb is already freed by lwip when this is called, only the slot has to be released
+	if (!arg)
+		return;
+	connection &client = *static_cast<connection*>(arg);
+	client.pcb = nullptr;
+	client.static_pending = {};
+	if (client.unprocessed)
+		pbuf_free(client.unprocessed);
+	client.unprocessed = nullptr;
+	if (client.deferred)
+		client.deferred->clear();
+	client.deferred = nullptr;
 }
 
 template template_args
@@ -233,17 +382,18 @@ constexpr static err_t tcp_server_accept (void *arg, struct tcp_pcb *client_pcb,
 	tcp_server template_args_pure& server = reinterpret_cast<tcp_server template_args_pure&>(*(char*)arg);
 	
 	// search for empty slot and assing it a new value
-	bool found_empty_spot{};
+	typename tcp_server template_args_pure::connection *client{};
 	int i{};
-	for (auto &pcb: server.client_pcbs) {
+	for (auto &c: server.connections) {
 		++i;
 		struct tcp_pcb *null{}; // should be nullptr
-		found_empty_spot |= pcb.compare_exchange_strong(null, client_pcb);
-		if (found_empty_spot)
+		if (c.pcb.compare_exchange_strong(null, client_pcb)) {
+			client = &c;
 			break;
+		}
 	}
 
-	if (!found_empty_spot) {
+	if (!client) {
 		LogError("All clients already connected, refusing");
 		err = tcp_close(client_pcb);
 		if (err != ERR_OK) {
@@ -255,8 +405,19 @@ constexpr static err_t tcp_server_accept (void *arg, struct tcp_pcb *client_pcb,
 	}
 
 	LogInfo("Client connected on id {}, setting up callbacks", i);
+	client->server = &server;
+	client->last_active_ms = sys_now();
+	client->requests = 0;
+	++client->generation;
+	client->request = &server.recieve_buffers[i - 1];
+	client->reset_request();
+	client->static_pending = {};
+	client->close_after_send = false;
+	client->unprocessed = nullptr;
+	client->unprocessed_offset = 0;
+	client->deferred = nullptr;
 	
-	tcp_arg(client_pcb, arg);
+	tcp_arg(client_pcb, client);
 	tcp_sent(client_pcb, tcp_server_sent template_args_pure);
 	tcp_recv(client_pcb, tcp_server_recv template_args_pure);
 	tcp_poll(client_pcb, tcp_server_poll template_args_pure, server.poll_time_s * 2);
@@ -290,11 +451,11 @@ void tcp_server template_args_pure::message_buffer::req_update_structured_views(
 		if (!extract_newline(buffer_view))
 			LogInfo("req_update_structured_views() did not find newline sequence after header");
 	}
-	// body (is simply the rest without the first newline, can be null so only logging missing newline on info level)
+	// end of the head (can be missing, so only logging on info level)
 	if (!extract_newline(buffer_view))
 		LogInfo("req_update_structured_views() did not find a newline for body info");
 	body = buffer_view;
-	buffer.append('\0');
+	buffer.make_c_str_safe();
 }
 
 template template_args
@@ -322,6 +483,12 @@ void tcp_server template_args_pure::message_buffer::res_set_status_line(std::str
 	buffer.append_formatted("{} {}\r\n", http_version, status);
 	this->http_version = buffer.sv();
 	this->status = buffer.sv();
+	if (keep_alive) {
+		res_add_header("Connection", "keep-alive");
+		res_add_header("Keep-Alive", static_format<16>("timeout={}", parent_server->idle_timeout_s));
+	} else {
+		res_add_header("Connection", "close");
+	}
 }
 
 template template_args
@@ -407,11 +574,8 @@ err_t tcp_server template_args_pure::start() {
 template template_args
 err_t tcp_server template_args_pure::stop() {
 	err_t err = ERR_OK;
-	for (auto &client_pcb: client_pcbs) {
-		if (client_pcb = nullptr) 
-			continue;
-		clear_client_pcb(client_pcb);
-	}
+	for (auto &c: connections)
+		tcp_server_internal::clear_client_pcb(c);
 	if (server_pcb) {
 		tcp_arg(server_pcb, NULL);
 		tcp_close(server_pcb);
@@ -423,55 +587,194 @@ err_t tcp_server template_args_pure::stop() {
 
 
 template template_args
-void tcp_server template_args_pure::process_request(uint32_t recieve_buffer_idx, struct tcp_pcb *client) {
-	if (recieve_buffer_idx >= recieve_buffers.size()) {
-		LogError("Impossible recieve buffer idx");
+auto tcp_server template_args_pure::find_endpoint(std::string_view method, std::string_view path) const -> const endpoint* {
+	const auto find = [path](const auto &endpoints) -> const endpoint* {
+		for (const endpoint &e: endpoints) {
+			if ((e.flags.path_match && path == e.path.data()) ||
+			    (!e.flags.path_match && path.starts_with(e.path.data())))
+				return &e;
+		}
+		return nullptr;
+	};
+	if (method == "GET")
+		return find(get_endpoints);
+	if (method == "POST")
+		return find(post_endpoints);
+	if (method == "PUT")
+		return find(put_endpoints);
+	if (method == "DELETE")
+		return find(delete_endpoints);
+	return nullptr;
+}
+
+template template_args
+uint32_t tcp_server template_args_pure::recieve(connection &client, const struct pbuf *p, uint32_t offset) {
+	message_buffer &req = *client.request;
+	uint32_t size = req.buffer.size();
+	uint32_t free_space = buf_size - 1 - size; // one byte is kept for the null termination of the body
+
+	if (client.state == connection::parse_state::HEAD) {
+		uint32_t n = pbuf_copy_partial(p, req.buffer.data() + size, std::min<uint32_t>(p->tot_len - offset, free_space), offset);
+		req.buffer.set_size(size + n);
+		// only the new data is searched for the end of the head
+		size_t head_end = req.buffer.sv().find("\r\n\r\n", client.scanned);
+		if (head_end == std::string_view::npos) {
+			client.scanned = std::max<int>(req.buffer.size() - 3, 0);
+			if (n == free_space)
+				process_request(client, STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE);
+			return n;
+		}
+		client.head_size = head_end + 4;
+		req.buffer.set_size(client.head_size); // data after the head is consumed again as body
+		req.req_update_structured_views();
+		client.target = find_endpoint(req.method, req.path);
+		client.state = connection::parse_state::BODY;
+
+		std::string_view length = req.headers_view.get_header("Content-Length");
+		if (!length.empty()) {
+			char *end{};
+			client.content_length = strtoul(length.data(), &end, 10);
+			if (end == length.data()) {
+				process_request(client, STATUS_BAD_REQUEST);
+				return client.head_size - size;
+			}
+		}
+		uint32_t room = buf_size - 1 - client.head_size;
+		bool chunked = client.target && client.target->body_callback;
+		if (client.content_length > room && (!chunked || room == 0))
+			process_request(client, STATUS_PAYLOAD_TOO_LARGE);
+		return client.head_size - size;
+	}
+
+	uint32_t n = std::min({p->tot_len - offset, client.content_length - client.body_recieved, free_space});
+	req.buffer.set_size(size + pbuf_copy_partial(p, req.buffer.data() + size, n, offset));
+	client.body_recieved += n;
+	if (client.target && client.target->body_callback && (n == free_space || client.body_recieved == client.content_length)) {
+		if (!client.target->body_callback(req, req.buffer.sv().substr(client.head_size))) {
+			process_request(client, STATUS_BAD_REQUEST);
+			return n;
+		}
+		req.buffer.set_size(client.head_size);
+	}
+	return n;
+}
+
+template template_args
+void tcp_server template_args_pure::consume(connection &client) {
+	// a request can span several pbufs and a pbuf can hold several (pipelined) requests,
+	// the loop ends when all data is consumed, the connection was closed, a static body is still being sent
+	// or a deferred response was not completed yet. p is null if only an already recieved request is pending
+	struct pbuf *p = std::exchange(client.unprocessed, nullptr);
+	uint32_t offset = client.unprocessed_offset;
+	uint32_t start = offset;
+	while (client.pcb) {
+		if (client.request_complete()) {
+			if (!client.static_pending.empty() || client.deferred)
+				break;
+			process_request(client);
+		} else if (p && offset < p->tot_len) {
+			offset += recieve(client, p, offset);
+		} else {
+			break;
+		}
+	}
+	if (!p)
+		return;
+	if (!client.pcb) {
+		pbuf_free(p);
 		return;
 	}
-	auto &recieve_buffer = recieve_buffers[recieve_buffer_idx];
+	tcp_recved(client.pcb, offset - start); // the window stays closed for data not yet processed
+	if (offset < p->tot_len) {
+		client.unprocessed = p;
+		client.unprocessed_offset = offset;
+	} else {
+		pbuf_free(p);
+		client.unprocessed_offset = 0;
+	}
+}
+
+template template_args
+void tcp_server template_args_pure::process_request(connection &client, std::string_view error_status) {
+	message_buffer &req = *client.request;
 
 	int free_send_idx = 0;
 	// the following also atomically reservers a buffer
 	for (; (uint32_t)free_send_idx < send_buffers.size() && send_buffers[free_send_idx].used.exchange(true) ; ++free_send_idx);
 	if ((uint32_t)free_send_idx >= send_buffers.size()) {
 		LogError("No free buffer for sending found, dropping request");
-		recieve_buffer.clear();
+		client.reset_request();
 		return;
 	}
 
 	auto &send_buffer = send_buffers[free_send_idx];
-	send_buffer.tpcb = client;
+	send_buffer.tpcb = client.pcb;
 	send_buffer.parent_server = this;
+	send_buffer.client = &client;
+
+	if (error_status.empty()) {
+		// HTTP/1.1 connections are persistent by default, HTTP/1.0 ones only on request
+		std::string_view connection_header = req.headers_view.get_header("Connection");
+		send_buffer.keep_alive = req.http_version == "HTTP/1.1" ? !iequals(connection_header, "close"): iequals(connection_header, "keep-alive");
+		send_buffer.keep_alive &= ++client.requests < max_keep_alive_requests;
+
+		// a chunked body was already handed to the body_callback
+		bool chunked = client.target && client.target->body_callback;
+		req.body = chunked ? std::string_view{req.buffer.end(), 0}: req.buffer.sv().substr(client.head_size);
+		req.buffer.make_c_str_safe();
+
+		LogInfo("Processing request frame and generating result {} {}", req.method, req.path);
+		if (client.target)
+			client.target->callback(req, send_buffer);
+		else
+			default_endpoint_cb(req, send_buffer);
+	} else {
+		// the rest of the request is not read, so the connection can not be reused
+		LogWarning("Rejecting request {} {}: {}", req.method, req.path, error_status);
+		send_buffer.res_set_status_line(HTTP_VERSION, error_status);
+		send_buffer.res_add_header("Content-Length", "0");
+	}
 
-	recieve_buffer.req_update_structured_views(); // parsing the recieve buffer
-
-	LogInfo("Processing request frame and generating result {} {}", recieve_buffer.method, recieve_buffer.path);
-	const auto prefixed_callback_call = [this, &recieve_buffer, &send_buffer](const auto &endpoints) {
-		for (const auto &[flags, prefix, callback]: endpoints) {
-			if ((flags.path_match && recieve_buffer.path == prefix.data()) ||
-			    (!flags.path_match && recieve_buffer.path.starts_with(prefix.data()))) {
-				callback(recieve_buffer, send_buffer);
-				return;
-			}
-		}
-		default_endpoint_cb(recieve_buffer, send_buffer);
-	};
-	if (recieve_buffer.method == "GET") 
-		prefixed_callback_call(get_endpoints);
-	else if (recieve_buffer.method == "POST") 
-		prefixed_callback_call(post_endpoints);
-	else if (recieve_buffer.method == "PUT")
-		prefixed_callback_call(put_endpoints);
-	else if (recieve_buffer.method == "DELETE")
-		prefixed_callback_call(delete_endpoints);
-	else
-		default_endpoint_cb(recieve_buffer, send_buffer);
+	client.reset_request();
+	if (send_buffer.deferred) { // the send buffer stays reserved until complete_deferred()
+		client.deferred = &send_buffer;
+		return;
+	}
+	send_response(client, send_buffer);
+}
 
+template template_args
+void tcp_server template_args_pure::send_response(connection &client, message_buffer &send_buffer) {
 	if (!send_buffer.body.data())
 		send_buffer.res_write_body();
-	send_data(send_buffer.buffer.sv(), client);
-	recieve_buffer.clear();
+	client.close_after_send = !send_buffer.keep_alive;
+	client.static_pending = send_buffer.static_body;
+	send_data(send_buffer.buffer.sv(), client.pcb);
 	send_buffer.clear();
+	if (!client.pcb)
+		return;
+	if (!client.static_pending.empty())
+		send_static(client);
+	else if (client.close_after_send) // close only after the response was queued, tcp_close sends it before the fin
+		tcp_server_internal::clear_client_pcb(client);
+}
+
+template template_args
+template<typename F>
+bool tcp_server template_args_pure::complete_deferred(deferred_response handle, F &&fill) {
+	if (handle.connection < 0 || handle.connection >= message_buffers)
+		return false;
+	connection &client = connections[handle.connection];
+	if (!client.pcb || client.generation != handle.generation || !client.deferred)
+		return false;
+	message_buffer &send_buffer = *std::exchange(client.deferred, nullptr);
+	send_buffer.deferred = false;
+	fill(send_buffer);
+	send_response(client, send_buffer);
+	// pipelined requests waited for this response
+	if (client.pcb && client.static_pending.empty())
+		consume(client);
+	return true;
 }
 
 template template_args
@@ -480,7 +783,7 @@ err_t tcp_server template_args_pure::send_data(std::string_view data, struct tcp
 	while (data.size()) {
 		uint32_t free_space = std::min<uint32_t>(tcp_sndbuf(client), data.size());
 
-		err_t err = tcp_write(client, data.data(), free_space, 0);
+		err_t err = tcp_write(client, data.data(), free_space, TCP_WRITE_FLAG_COPY); // the buffer is reused directly after
 		if (err != ERR_OK) {
 			LogWarning("Failed to write data {}, retries left {}", err, retry);
 			if (--retry > 0) {
@@ -499,3 +802,24 @@ err_t tcp_server template_args_pure::send_data(std::string_view data, struct tcp
 	return ERR_OK;
 }
 
+template template_args
+void tcp_server template_args_pure::send_static(connection &client) {
+	while (!client.static_pending.empty()) {
+		uint32_t n = std::min<uint32_t>({tcp_sndbuf(client.pcb), uint32_t(client.static_pending.size()), 0xffff});
+		if (n == 0)
+			break;
+		// no TCP_WRITE_FLAG_COPY, lwip references the data until it is acknowledged
+		err_t err = tcp_write(client.pcb, client.static_pending.data(), n, 0);
+		if (err == ERR_MEM) // send queue full, continued from tcp_sent
+			break;
+		if (err != ERR_OK) {
+			LogError("Failed to write static data {}", err);
+			tcp_server_internal::clear_client_pcb(client);
+			return;
+		}
+		client.static_pending.remove_prefix(n);
+	}
+	tcp_output(client.pcb);
+	if (client.static_pending.empty() && client.close_after_send)
+		tcp_server_internal::clear_client_pcb(client);
+}
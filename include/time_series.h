@@ -0,0 +1,176 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+
+#include "history_block.h"
+#include "mutex.h"
+#include "static_types.h"
+
+/**
+ * @brief Fixed memory history of the battery and ac measurements in multiple resolution tiers.
+ * Every tier stores min/max/mean per channel as fixed point int16 in compressed history_blocks,
+ * timestamps are implicit (block start + index * resolution), short gaps are stored as invalid samples,
+ * after longer gaps a new block is started. When a tier is full its oldest block is dropped.
+ * The finest tier is fed via add(), every completed bucket is aggregated into the next coarser tier.
+ * Time is the uptime in seconds, a single writer task and multiple readers are supported.
+ */
+
+/** @brief min/max/mean accumulator for the bucket currently being filled */
+struct history_accumulator {
+	std::array<int32_t, HISTORY_CHANNELS> sum{};
+	std::array<int16_t, HISTORY_CHANNELS> min{};
+	std::array<int16_t, HISTORY_CHANNELS> max{};
+	uint32_t count{};
+
+	void add(const history_sample &s) {
+		if (!s.valid())
+			return;
+		for (int c = 0; c < HISTORY_CHANNELS; ++c) {
+			sum[c] += s.mean[c];
+			min[c] = count ? std::min(min[c], s.min[c]): s.min[c];
+			max[c] = count ? std::max(max[c], s.max[c]): s.max[c];
+		}
+		++count;
+	}
+	history_sample result() const {
+		history_sample s{};
+		if (!count)
+			return s;
+		for (int c = 0; c < HISTORY_CHANNELS; ++c) {
+			s.min[c] = min[c];
+			s.max[c] = max[c];
+			s.mean[c] = int16_t((sum[c] + (sum[c] < 0 ? -int32_t(count / 2): int32_t(count / 2))) / int32_t(count));
+		}
+		return s;
+	}
+};
+
+template<int BLOCKS>
+struct history_tier {
+	static constexpr uint32_t MAX_GAP{32}; // longer gaps start a new block instead of storing invalid samples
+
+	uint32_t resolution_s{};
+	static_ring_buffer<history_block, BLOCKS> blocks{};
+	history_prediction prediction{};	// of the newest block
+	uint32_t cur_start{};			// start time of the bucket in acc
+	bool started{};
+	history_accumulator acc{};
+
+	/** @brief calls on_close(start, sample) with the completed bucket if t opens a new bucket */
+	template<typename F>
+	void add(uint32_t t, const history_sample &s, F &&on_close) {
+		uint32_t start = t - t % resolution_s;
+		if (!started) {
+			started = true;
+			cur_start = start;
+		}
+		if (start != cur_start) {
+			history_sample closed = acc.result();
+			store(cur_start, closed);
+			on_close(cur_start, closed);
+			acc = {};
+			cur_start = start;
+		}
+		acc.add(s);
+	}
+	/*INTERNAL*/ void store(uint32_t start, const history_sample &s) {
+		history_block *b = blocks.back();
+		if (b) {
+			uint32_t next_start = b->first_start + b->count * resolution_s;
+			uint32_t gap = (start - next_start) / resolution_s;
+			if (gap > MAX_GAP || start < next_start)
+				b = nullptr;
+			for (uint32_t i = 0; b && i < gap; ++i)
+				b = push(b, next_start + i * resolution_s, history_sample{});
+		}
+		push(b, start, s);
+	}
+	/*INTERNAL*/ history_block* push(history_block *b, uint32_t start, const history_sample &s) {
+		if (b && b->push(s, prediction))
+			return b;
+		b = blocks.push();
+		*b = history_block{.first_start = start};
+		prediction = {};
+		b->push(s, prediction);
+		return b;
+	}
+	const history_block& at(int i) const { return blocks.storage[(blocks.cur_start + i) % BLOCKS]; }
+	uint32_t end_start(const history_block &b) const { return b.first_start + b.count * resolution_s; }
+};
+
+struct time_series {
+	static constexpr int PAGE_SAMPLES{48}; // keeps a json page well below the 4k send buffer
+
+	// spans depend on the signal, 3-10 bytes per sample for typical battery data
+	history_tier<48> seconds{.resolution_s = 1};	// 6 KB, ~30 minutes
+	history_tier<128> minutes{.resolution_s = 60};	// 16 KB, ~2-3 days
+	history_tier<176> quarters{.resolution_s = 900};	// 22 KB, ~25-40 days
+	mutex lock{};
+
+	static time_series& Default() {
+		static time_series t{};
+		return t;
+	}
+
+	static constexpr bool has_resolution(uint32_t resolution_s) { return resolution_s == 1 || resolution_s == 60 || resolution_s == 900; }
+
+	/** @brief Adds a raw measurement, can be called at any rate, values are aggregated into 1 s buckets */
+	void add(uint32_t now_s, std::array<float, HISTORY_CHANNELS> values) {
+		history_sample s{};
+		for (int c = 0; c < HISTORY_CHANNELS; ++c)
+			s.min[c] = s.max[c] = s.mean[c] = history_sample::to_fixed(values[c], history_channel(c));
+		scoped_lock l{lock};
+		seconds.add(now_s, s, [this](uint32_t start, const history_sample &s) {
+			if (!s.valid())
+				return;
+			minutes.add(start, s, [this](uint32_t start, const history_sample &s) {
+				if (s.valid())
+					quarters.add(start, s, [](uint32_t, const history_sample &){});
+			});
+		});
+	}
+
+	/**
+	 * @brief Calls f(start_s, sample) with the lock held for at max PAGE_SAMPLES stored samples in [from_s, to_s]
+	 * of the tier with the given resolution.
+	 * @return start time of the next page, 0 if all samples were visited
+	 */
+	template<typename F>
+	uint32_t for_each(uint32_t resolution_s, uint32_t from_s, uint32_t to_s, F &&f) {
+		scoped_lock l{lock};
+		const auto iterate = [&](const auto &tier) -> uint32_t {
+			int n{};
+			uint32_t expected{};
+			for (int i = 0; i < tier.blocks.size(); ++i) {
+				const history_block &b = tier.at(i);
+				if (tier.end_start(b) <= from_s)
+					continue;
+				if (b.first_start > to_s)
+					return 0;
+				if (n && b.first_start != expected) // pages are contiguous, continue with the next block
+					return b.first_start;
+				for (history_block_reader r{b}; !r.done();) {
+					uint32_t start = r.start(tier.resolution_s);
+					if (start > to_s)
+						return 0;
+					if (start >= from_s && n == PAGE_SAMPLES)
+						return start;
+					history_sample s = r.next();
+					if (start < from_s)
+						continue;
+					f(start, s);
+					++n;
+				}
+				expected = tier.end_start(b);
+			}
+			return 0;
+		};
+		switch (resolution_s) {
+		case 1: return iterate(seconds);
+		case 60: return iterate(minutes);
+		case 900: return iterate(quarters);
+		default: return 0;
+		}
+	}
+};
@@ -7,6 +7,7 @@
 #include "measurements.h"
 #include "wifi_storage.h"
 #include "access_point.h"
+#include "ve_bus.h"
 
 // handle exactly one command from the input stream at a time (should be called in an endless loop)
 static constexpr inline void handle_usb_command(std::istream &in = std::cin, std::ostream &out = std::cout) {
@@ -30,7 +31,7 @@ static constexpr inline void handle_usb_command(std::istream &in = std::cin, std
 		out << "  h|-h|--help|help\n";
 		out << "    Prints This help menu\n\n";
 		out << "  status\n";
-		out << "    Prints the status of the iot device, including measurement values, setting values, error state, wifi status\n\n";
+		out << "    Prints the status of the iot device, including measurement values, setting values, error state, wifi status, ve bus statistics\n\n";
 		out << "  set ${variable} ${value}\n";
 		out << "    Set the value of a variable. Available variables are:\n";
 		out << "      Variable1\n";
@@ -65,6 +66,9 @@ static constexpr inline void handle_usb_command(std::istream &in = std::cin, std
 		out << "-------------\n";
 		out << wifi_storage::Default();
 		out << "Access point active: " << (access_point::Default().active ? "true": "false") << '\n';
+		out << "ve bus:\n";
+		out << "-------------\n";
+		out << VEBus::Default().GetStats();
 	} else if (command == "set") {
 		in >> settings::Default(); // sets fail bit on error
 		if (!in)
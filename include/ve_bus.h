@@ -11,8 +11,16 @@
 #define UART_MODE_RS485
 
 #include "ve_bus_definition.h"
+#include "ve_bus_frame_layout.h"
+#include "ve_bus_frame_encoder.h"
+#include "ve_bus_frame_receiver.h"
+#include "ve_bus_request_ids.h"
+#include "energy_counter.h"
+#include "seqlock.h"
 
 #include <functional>
+#include <ostream>
+#include <string_view>
 #include <variant>
 #include <FreeRTOS.h>
 #include <semphr.h>
@@ -25,14 +33,42 @@ struct VEBus
         static VEBus ve_bus{serial};
         return ve_bus;
     }
-    static void DestuffingFAtoFF(VEBusBuffer& buffer);
+    enum FrameStat : uint8_t
+    {
+        SyncFrames,
+        ResponseFrames,
+        InfoFrames,
+        LedFrames,
+        BatteryConditionFrames,
+        ChargerInverterFrames,
+        AcPhaseFrames,
+        UnknownFrames,
+        FrameStatCount
+    };
+    static constexpr std::array<std::string_view, FrameStatCount> FRAME_STAT_NAMES{"sync", "response", "info", "led", "battery", "charger_inverter", "ac_phase", "unknown"};
 
-    struct ResponseData
+    // counters since startup, collected by the communication task and published once a second
+    struct Stats
     {
-        uint8_t id;
-        uint8_t command;
-        uint8_t address;
-        std::variant<u32, i32, f32> value;
+        std::array<uint32_t, FrameStatCount> frames;
+        uint32_t rxBytes;
+        uint32_t txBytes;
+        uint32_t checksumErrors;
+        uint32_t escapeErrors;
+        uint32_t shortFrames;
+        uint32_t rxOverruns;      // bytes lost because the receive ring was not read in time
+        uint32_t droppedFrames;   // longer than VEBUS_MAX_BUFFER_SIZE
+        uint32_t resends;
+        uint32_t timeouts;
+        uint32_t queueHighWater;  // max fifo entries seen at a sync frame
+        uint32_t sends;
+        uint64_t syncToSendSumUs; // frame notification of the sync frame -> request written
+        uint32_t syncToSendMaxUs;
+        uint32_t missedSyncs;     // requests sent later than VEBUS_SYNC_SEND_WINDOW_US after their sync frame
+        uint32_t wakeups;         // frame notification -> communication task running (receive jitter)
+        uint64_t wakeLatencySumUs;
+        uint32_t wakeLatencyMaxUs;
+        uint32_t busLoadPermille; // of the last second
     };
 
     enum RequestError
@@ -41,9 +77,44 @@ struct VEBus
         FifoFull,
         OutsideLowerRange,
         OutsideUpperRange,
-        ConvertError
+        ConvertError,
+        Timeout,   // no valid response after VEBUS_MAX_RESEND resends
+        Rejected,  // the device answered with an unexpected response code (eg. variable not supported)
+        Cancelled,
+        Superseded // a newer write with its own completion replaced the value before it was sent
+    };
+
+    struct ResponseData
+    {
+        uint8_t id;
+        uint8_t command;
+        uint8_t address;
+        std::variant<u32, i32, f32> value;
+        RequestError error{RequestError::Success};
+    };
+
+    // per request completion, called exactly once from the communication task when the request completed,
+    // timed out or was rejected (not called after Cancel()). Requests with a completion are never merged or replaced,
+    // except power writes which complete the superseded completion from the task calling SetPower().
+    struct Completion
+    {
+        void (*cb)(const ResponseData &response, void *user);
+        void *user;
     };
 
+    // transmit order of queued requests, within a class the oldest request is sent first
+    enum RequestPriority : uint8_t
+    {
+        Realtime,   // control writes (SetPower, SetSwitch, ram var writes)
+        Telemetry,  // ram var and setting reads, polling
+        Background, // info/version/device state queries, setting writes
+        PriorityCount
+    };
+    static constexpr std::array<std::string_view, PriorityCount> PRIORITY_NAMES{"realtime", "telemetry", "background"};
+    // upper bounds of the queue wait histogram buckets, the last bucket counts everything above
+    static constexpr std::array<uint32_t, 7> QUEUE_WAIT_BUCKETS_MS{10, 20, 50, 100, 200, 500, 1000};
+    using QueueWaitHistogram = std::array<uint32_t, QUEUE_WAIT_BUCKETS_MS.size() + 1>;
+
     struct RequestResult
     {
         uint8_t id;
@@ -51,13 +122,13 @@ struct VEBus
     };
 
     std::function<void(ResponseData&)> response_cb;
-    std::function<void(VEBusBuffer&)> receive_cb;
+    // called from the communication task for each received frame, the frame is only valid during the call
+    std::function<void(VEBusFrame)> receive_cb;
 
     VEBus(Serial& serial);
     ~VEBus();
 
     void Setup(bool autostart = true);
-    void Maintain();
 
     void StartCommunication();
     void StopCommunication();
@@ -66,21 +137,53 @@ struct VEBus
     //*EEPROM writes are limited
     //*Returns 0 if failed
     using val_var = std::variant<u16, i16, f32>;
-    RequestResult WriteViaID(RamVariables variable, val_var value, bool eeprom = false);
-    RequestResult WriteViaID(Settings setting, val_var value, bool eeprom = false);
-
-    // Charge battery with negative power values, discharge with positive numbers
-    RequestResult SetPower(i16 power_w);
+    RequestResult WriteViaID(RamVariables variable, val_var value, bool eeprom = false, Completion completion = {});
+    RequestResult WriteViaID(Settings setting, val_var value, bool eeprom = false, Completion completion = {});
+
+    // Charge battery with negative power values, discharge with positive numbers.
+    // Without completion the write is skipped (id 0, Success) if the same value was acknowledged
+    // less than VEBUS_WRITE_KEEPALIVE_MS ago. A queued but not yet sent write only gets its value replaced,
+    // so at most one write per device waits in the fifo. A given completion replaces the one of the queued write,
+    // which is completed with Superseded by the calling task
+    RequestResult SetPower(i16 power_w, Completion completion = {}, uint8_t device = 0);
+    // Splits power_w evenly across all VEBUS_DEVICE_COUNT devices, the writes are sent in the same sync slot.
+    // The completion is attached to the write of device 0, which is queued last.
+    // Returns the result of the first failing write or the one of device 0
+    RequestResult SetClusterPower(i32 power_w, Completion completion = {});
 
     //*Read EEPROM saved Value
     //*Returns 0 if failed
-    uint8_t Read(RamVariables variables);
-    uint8_t Read(Settings setting);
-
-    uint8_t ReadInfo(RamVariables variable);
-    uint8_t ReadInfo(Settings setting);
-
+    //*RAM variable reads are merged into a not yet sent read request (up to MAX_RAM_VARS_PER_READ),
+    //*response_cb is called once per variable with the id of the merged request.
+    //*If a completion is given only the completion is called, not response_cb.
+    //*device selects the unit of the cluster which is asked, 0 is the master
+    uint8_t Read(RamVariables variables, Completion completion = {}, uint8_t device = 0);
+    uint8_t Read(Settings setting, Completion completion = {}, uint8_t device = 0);
+
+    uint8_t ReadInfo(RamVariables variable, Completion completion = {}, uint8_t device = 0);
+    uint8_t ReadInfo(Settings setting, Completion completion = {}, uint8_t device = 0);
+
+    //*Blocks the calling task until the response arrived or timeout passed (the request is cancelled then).
+    //*Uses the task notification of the calling task
+    ResponseData ReadBlocking(RamVariables variable, TickType_t timeout);
+    ResponseData ReadBlocking(Settings setting, TickType_t timeout);
+
+    //*Removes a request from the fifo, returns false if it was not queued (anymore),
+    //*in which case its completion was already or is just being called
+    bool Cancel(uint8_t id);
+
+    // skipped if the same state was queued less than VEBUS_WRITE_KEEPALIVE_MS ago
     void SetSwitch(SwitchState state);
+
+    //*Periodically reads the variable/setting every period_ms, results are reported via response_cb.
+    //*Requests are only issued in sync slots not used by other requests, earliest deadline first,
+    //*ram variables which are due are packed into a single request.
+    //*Registering an already registered variable updates the period, a period of 0 removes it.
+    //*Returns false if no poll entry is free
+    bool Poll(RamVariables variable, uint32_t period_ms);
+    bool Poll(Settings setting, uint32_t period_ms);
+    // amount of poll requests which were issued after their deadline (release time + period)
+    uint32_t GetPollMissedDeadlines() const { return _pollMissedDeadlines; }
  
     const RAMVarInfo& GetRamVarInfo(RamVariables variable);
     const SettingInfo& GetSettingInfo(Settings setting);
@@ -93,13 +196,39 @@ struct VEBus
 
     bool NewDcInfoAvailable();
     DcInfo GetDcInfo();
+    // called from the communication task whenever the dc info changed, has to be set before Setup()
+    void OnDcInfo(void (*cb)(const DcInfo &info, void *user), void *user = nullptr) { _dcInfoCallback = {cb, user}; }
 
     uint8_t NewAcInfoAvailable();
     AcInfo GetAcInfo(uint8_t type);
 
+    // sum over all devices of the cluster which already reported their ac info
+    struct ClusterInfo
+    {
+        uint8_t Devices;
+        float MainPowerW;
+        float InverterPowerW;
+        float MinMainVoltage;
+        float MaxMainVoltage;
+        DcInfo Dc; // the battery is shared by all devices
+    };
+    // does not reset the new info flags
+    AcInfo GetDeviceAcInfo(uint8_t device);
+    ClusterInfo GetClusterInfo();
+
     //Get VE.BUS Version
-    uint8_t ReadSoftwareVersion();
-    uint8_t CommandReadDeviceState();
+    uint8_t ReadSoftwareVersion(uint8_t device = 0);
+    uint8_t CommandReadDeviceState(uint8_t device = 0);
+
+    // time between queueing and the first transmission of the requests of a priority class, resends are not counted
+    const QueueWaitHistogram& GetQueueWaitHistogram(RequestPriority priority) const { return _queueWaitHistogram[priority]; }
+
+    Stats GetStats() const { return _statsSnapshot.peek(); }
+
+    // charge and energy counted since the first start, integrated from every dc/ac info frame
+    energy_totals GetEnergy() const { return _energy.get(); }
+    // continues counting from persisted totals, has to be called before Setup()
+    void RestoreEnergy(const energy_totals &totals) { _energy.restore(totals); }
 
     struct Data
     {
@@ -110,56 +239,150 @@ struct VEBus
         uint8_t command;
         uint8_t address;
         uint8_t expectedResponseCode = 0;
-        uint32_t sentTimeMs;
+        uint8_t device = 0; // winmon requests only, 0 is the master
+        RequestPriority priority = RequestPriority::Background;
+        uint32_t sentTimeMs; // queue time while IsSent is false
         uint32_t resendCount = 0;
         VEBusBuffer requestData{};
         VEBusBuffer responseData{};
+        static_vector<uint8_t, MAX_RAM_VARS_PER_READ> addresses{}; // only for ReadRAMVar
+        Completion completion{};
+    };
+
+    struct BlockingCompletion
+    {
+        TaskHandle_t task{};
+        ResponseData response{};
+        std::atomic<bool> done{};
+        static void complete(const ResponseData &response, void *user);
+    };
+
+    // last value written to the device, used to suppress unchanged writes
+    struct WriteCache
+    {
+        bool valid;
+        uint16_t value;
+        uint32_t timeMs; // time of the acknowledgement (SetPower) or queueing (SetSwitch)
+    };
+
+    struct PollEntry
+    {
+        uint8_t command;
+        uint8_t address;
+        uint32_t periodMs;
+        uint32_t releaseMs; // next time the request should be issued, deadline is releaseMs + periodMs
+        uint32_t missedDeadlines;
     };
 
     Serial& serial;
+    // guards the fifo, the poll entries and the write caches. It is only held for short sections,
+    // so it is always taken with portMAX_DELAY instead of running the section unlocked on a timeout
     SemaphoreHandle_t _semaphoreDataFifo;
-    SemaphoreHandle_t _semaphoreStatus;
-    SemaphoreHandle_t _semaphoreReceiveData;
-    uint8_t _id;
     static_vector<Data, VEBUS_FIFO_SIZE> _dataFifo;
-    //Runs on core 0. not thread save.
-    VEBusBuffer _receiveBuffer;
-    static_vector<VEBusBuffer, VEBUS_MAX_RECEIVE_BUFFER> _receiveBufferList;
+    ve_bus_request_ids _requestIds{}; // ids of the fifo entries, guarded by _semaphoreDataFifo
+    static_vector<PollEntry, VEBUS_MAX_POLL_ENTRIES> _pollEntries; // guarded by _semaphoreDataFifo
+    uint32_t _pollMissedDeadlines{};
+    std::array<QueueWaitHistogram, RequestPriority::PriorityCount> _queueWaitHistogram{};
+    std::array<WriteCache, VEBUS_DEVICE_COUNT> _powerWrite{}; // per device, guarded by _semaphoreDataFifo
+    WriteCache _switchWrite{}; // guarded by _semaphoreDataFifo
+    // earliest response timeout of all fifo entries, armed under _semaphoreDataFifo
+    std::atomic<uint32_t> _nextTimeoutMs{};
+    std::atomic<bool> _timeoutArmed{};
+    //Runs on core 0. not thread save. Holds the destuffed frame which is currently received
+    VEBusFrameReceiver<VEBUS_MAX_BUFFER_SIZE> _receiver;
+    // encoded request frame, only used by sendData() (communication task)
+    std::array<uint8_t, VEBusFrameEncoder::maxFrameSize(VEBUS_MAX_BUFFER_SIZE)> _sendArena;
     SettingInfos _settingInfoList = DefaultSettingInfos;
     RAMVarInfos _ramVarInfoList = DefaultRamVarInfos;
-    static_vector<AcInfo, PHASES_COUNT> _acInfo;
-    DcInfo _dcInfo;
-
-    MasterMultiLed _masterMultiLed;
-    volatile bool _masterMultiLedNewData = false;
-    volatile bool _masterMultiLedLogged = false;
-
-    MultiPlusStatus _multiPlusStatus;
-    volatile bool _multiPlusStatusNewData = false;
-    volatile bool _multiPlusStatusLogged = false;
+    // working copies of the decoder, only accessed by the communication task
+    std::array<AcInfo, PHASES_COUNT> _acInfo{};
+    DcInfo _dcInfo{};
+    MasterMultiLed _masterMultiLed{};
+    MultiPlusStatus _multiPlusStatus{};
+
+    // snapshots published by the decoder, read lock free by all other tasks
+    std::array<seqlock<AcInfo>, PHASES_COUNT> _acInfoSnapshot;
+    seqlock<DcInfo> _dcInfoSnapshot;
+    struct { void (*cb)(const DcInfo &info, void *user); void *user; } _dcInfoCallback{};
+    seqlock<MasterMultiLed> _masterMultiLedSnapshot;
+    seqlock<MultiPlusStatus> _multiPlusStatusSnapshot;
+
+    // working copy of the communication task, published to _statsSnapshot by publishStats()
+    Stats _stats{};
+    seqlock<Stats> _statsSnapshot;
+    uint32_t _statsWindowMs{};
+    uint32_t _statsWindowBytes{};
+    energy_counter _energy{};
 
     bool _communitationIsRunning = false;
     volatile bool _communitationIsResumed = false;
 
-    void addOrUpdateFifo(const Data &data, bool updateIfExist = true);
-
-
-    bool getNextFreeId_1(uint8_t &id);
-
-    ReceivedMessageType decodeVEbusFrame(VEBusBuffer &buffer);
-    void decodeChargerInverterCondition(VEBusBuffer &buffer); //0x80
-    void decodeBatteryCondition(VEBusBuffer &buffer); //0x70
-    void decodeMasterMultiLed(VEBusBuffer &buffer); //0x41
-    void decodeInfoFrame(VEBusBuffer &buffer); // 0x20
+    // returns false if the fifo is full or no id is free. The id is allocated here and written into the request,
+    // data.id is set to the id of the entry which answers the request, a pending read which already contains all variables of data is kept
+    bool addOrUpdateFifo(Data &data, bool updateIfExist = true);
+
+
+    // fifo modifications which keep the id table up to date, have to be called with _semaphoreDataFifo taken.
+    // The id of a request is allocated when it is added, so no other task can get the same id
+    bool assignFreeId(Data &data);
+    bool pushFifoEntry(Data &data);
+    void setFifoEntry(int idx, const Data &data);
+    void removeFifoEntry(int idx);
+    Data* findFifoEntry(uint8_t id);
+    bool addPoll(uint8_t command, uint8_t address, uint32_t period_ms);
+    Data* schedulePoll();
+
+    // dispatches via the frame layouts in ve_bus_frame_layout.h
+    ReceivedMessageType decodeVEbusFrame(VEBusFrame buffer);
+    void decodeResponseFrame(VEBusFrame buffer); //0x00
+    void decodeChargerInverterCondition(VEBusFrame buffer); //0x80
+    void decodeBatteryCondition(VEBusFrame buffer); //0x70
+    void decodeMasterMultiLed(VEBusFrame buffer); //0x41
+    void decodeInfoFrame(VEBusFrame buffer); // 0x20
+    void decodeAcPhaseInformation(VEBusFrame buffer); // 0xE4
+    float decodeField(const VEBusFrameLayout::Field &field, VEBusFrame buffer) const;
 
     void saveSettingInfoData(const Data& data);
     void saveRamVarInfoData(const Data& data);
-    // returns true if command handling is done (a full frame was processed and no waiting receive)
+    // returns true if a full frame was processed, false if no complete frame is waiting in the receive ring
     bool commandHandling();
+    // feeds the receive ring into _receiver until a valid frame is complete, corrupt frames are counted and dropped.
+    // Returns an empty frame if no more bytes are available
+    VEBusFrame receiveFrame();
 
     void sendData(VEBus::Data& data, uint8_t frameNr);
     void saveResponseData(const Data &data);
-    void checkResponseMessage();
+    static void completeWithError(const Data &data, RequestError error);
+    ResponseData waitBlocking(uint8_t id, BlockingCompletion &wait, TickType_t timeout);
+    void armResponseTimeout(uint32_t deadlineMs);
+    TickType_t ticksUntilResponseTimeout() const;
+    void saveRamVarValue(ResponseData &responseData, uint8_t lowByte, uint8_t highByte);
+    // only scans the fifo if the earliest response timeout has passed
     void checkResponseTimeout();
+    void countWakeup(uint32_t latencyUs);
+    // updates the bus load and publishes the statistics and energy counters, at max once a second
+    void publishStats();
 };
 
+inline std::ostream& operator<<(std::ostream &os, const VEBus::Stats &s) {
+    for (int i = 0; i < VEBus::FrameStatCount; ++i)
+        os << "frames_" << VEBus::FRAME_STAT_NAMES[i] << ": " << s.frames[i] << '\n';
+    os << "rx_bytes: " << s.rxBytes << '\n';
+    os << "tx_bytes: " << s.txBytes << '\n';
+    os << "bus_load_permille: " << s.busLoadPermille << '\n';
+    os << "checksum_errors: " << s.checksumErrors << '\n';
+    os << "escape_errors: " << s.escapeErrors << '\n';
+    os << "short_frames: " << s.shortFrames << '\n';
+    os << "rx_overruns: " << s.rxOverruns << '\n';
+    os << "dropped_frames: " << s.droppedFrames << '\n';
+    os << "resends: " << s.resends << '\n';
+    os << "timeouts: " << s.timeouts << '\n';
+    os << "queue_high_water: " << s.queueHighWater << '\n';
+    os << "sends: " << s.sends << '\n';
+    os << "sync_to_send_avg_us: " << (s.sends ? s.syncToSendSumUs / s.sends: 0) << '\n';
+    os << "sync_to_send_max_us: " << s.syncToSendMaxUs << '\n';
+    os << "missed_syncs: " << s.missedSyncs << '\n';
+    os << "wake_latency_avg_us: " << (s.wakeups ? s.wakeLatencySumUs / s.wakeups: 0) << '\n';
+    os << "wake_latency_max_us: " << s.wakeLatencyMaxUs << '\n';
+    return os;
+}
@@ -1,10 +1,15 @@
 #pragma once
 
 #include "VEBusConfig.h"
+#ifdef VEBUS_SIMULATOR
+#include "ve_bus_simulator.h"
+#else
 #include "rs485_serial.h"
+#endif
 #include "static_types.h"
 #include <hardware/timer.h>
 #include <array>
+#include <span>
 
 //Default for Multiplus-II 48/5000
 #define MULTIPLUS_II_48_5000
@@ -12,11 +17,18 @@
 namespace VEBusDefinition
 {
     constexpr uint32_t FIFO_MAX_SIZE{256};
-    static const rs485_serial::rs485_info SerialInfos{
+    constexpr int MAX_RAM_VARS_PER_READ{6}; // max addresses in a single ReadRAMVar request
+#ifdef VEBUS_SIMULATOR
+    using Serial = ve_bus_simulator;
+#else
+    using Serial = rs485_serial;
+#endif
+    static const Serial::rs485_info SerialInfos{
         .baudrate = VEBUS_RS485_BAUD,
         .tx_pin = VEBUS_RS485_TX_PIN,
         .rx_pin = VEBUS_RS485_RX_PIN,
         .en_pin = VEBUS_RS485_EN_PIN,
+        .rx_poll_us = VEBUS_RS485_RX_POLL_US,
     };
     using u8 = uint8_t;
     using i16 = int16_t;
@@ -24,8 +36,8 @@ namespace VEBusDefinition
     using i32 = int32_t;
     using u32 = uint32_t;
     using f32 = float;
-    using Serial = rs485_serial;
     using VEBusBuffer = static_vector<uint8_t, VEBUS_MAX_BUFFER_SIZE>;
+    using VEBusFrame = std::span<uint8_t>; // borrowed view onto a received frame, only valid during the callback
     inline uint32_t millis() { return static_cast<uint32_t>(time_us_64() / 1000); }
 
     enum WinmonCommand : uint8_t
@@ -257,6 +269,16 @@ namespace VEBusDefinition
     constexpr uint8_t PHASE_START = static_cast<uint8_t>(PhaseInfo::L4);
     constexpr uint8_t PHASE_END = static_cast<uint8_t>(PhaseInfo::DC) + 1;
     constexpr uint8_t PHASES_COUNT = static_cast<uint8_t>(PhaseInfo::DC) - static_cast<uint8_t>(PhaseInfo::L4);
+    // in a three phase system device 0 (master) reports L1, device 1 L2, ...
+    constexpr PhaseInfo DeviceToPhase(uint8_t device) { return static_cast<PhaseInfo>(static_cast<uint8_t>(PhaseInfo::S_L1) - device); }
+    // inverse of DeviceToPhase, VEBUS_DEVICE_COUNT if no configured device reports the phase
+    constexpr uint8_t PhaseToDevice(PhaseInfo p) {
+        for (uint8_t device = 0; device < VEBUS_DEVICE_COUNT; ++device)
+            if (DeviceToPhase(device) == p)
+                return device;
+        return VEBUS_DEVICE_COUNT;
+    }
+    static_assert(VEBUS_DEVICE_COUNT >= 1 && VEBUS_DEVICE_COUNT <= 4);
 
     enum PhaseState
     {
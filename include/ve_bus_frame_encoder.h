@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+/**
+ * @brief Single pass encoder for VE.Bus request frames
+ * 98 F7 FE <frame nr> <stuffed payload> <checksum> FF
+ * Prefix, payload with FA..FF stuffed as FA 7x, checksum and end of frame are written in one pass
+ * directly into the transmit buffer. The checksum covers all transmitted bytes after the MK3 address,
+ * an escape FA 7x counts as both bytes (see VEBusFrameReceiver).
+ */
+struct VEBusFrameEncoder
+{
+    static constexpr uint8_t MK3_ADDRESS_0{0x98};
+    static constexpr uint8_t MK3_ADDRESS_1{0xF7};
+    static constexpr uint8_t DATA_FRAME_KIND{0xFE};
+    static constexpr uint8_t ESCAPE{0xFA};
+    static constexpr uint8_t END_OF_FRAME{0xFF};
+
+    /** @brief Worst case frame size, every payload byte and the checksum are stuffed */
+    static constexpr size_t maxFrameSize(size_t payloadSize) { return 4 + 2 * payloadSize + 3; }
+
+    /** @brief Writes the frame of payload with the frame number following lastFrameNr into out.
+      * Returns the frame size, 0 if out is smaller than maxFrameSize(payload.size()) */
+    static uint32_t encode(std::span<const uint8_t> payload, uint8_t lastFrameNr, std::span<uint8_t> out) {
+        if (out.size() < maxFrameSize(payload.size()))
+            return 0;
+        uint8_t *dst = out.data();
+        *dst++ = MK3_ADDRESS_0;
+        *dst++ = MK3_ADDRESS_1;
+        *dst++ = DATA_FRAME_KIND;
+        *dst++ = (lastFrameNr + 1) & 0x7F;
+        uint8_t cs = 1 - DATA_FRAME_KIND - dst[-1];
+        for (uint8_t v: payload) {
+            if (v >= ESCAPE) {
+                *dst++ = ESCAPE;
+                *dst = 0x70 | (v & 0x0F);
+                cs -= ESCAPE + *dst++;
+            } else {
+                *dst++ = v;
+                cs -= v;
+            }
+        }
+        if (cs >= 0xFB) {
+            *dst++ = ESCAPE;
+            *dst++ = cs - ESCAPE;
+        } else
+            *dst++ = cs;
+        *dst++ = END_OF_FRAME;
+        return dst - out.data();
+    }
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "ve_bus_definition.h"
+
+#include <array>
+#include <span>
+
+// Declarative description of the VE.Bus frames received from the MultiPlus.
+// All offsets are relative to the destuffed frame (including the two address bytes,
+// frame type and frame number). Byte 4 is the frame type used for the dispatch.
+namespace VEBusFrameLayout
+{
+    using namespace VEBusDefinition;
+    constexpr uint8_t NO_RAM_VAR{0xFF};
+    constexpr uint8_t NO_FACTOR{0xFF};
+    constexpr uint8_t NO_FRAME{0xFF};
+
+    // (frame[offset] & mask) == value
+    struct Match
+    {
+        uint8_t offset;
+        uint8_t mask{0xFF};
+        uint8_t value;
+
+        constexpr bool operator()(std::span<const uint8_t> frame) const { return (frame[offset] & mask) == value; }
+    };
+
+    // little endian integer of width bytes, value = raw * scale.
+    // If ram_var is set the scale and offset of the RAMVarInfo are applied instead (at runtime, see VEBus::decodeField),
+    // if factor_offset is set the value is multiplied by the unsigned byte at that offset.
+    struct Field
+    {
+        uint8_t offset;
+        uint8_t width{1};
+        bool is_signed{};
+        float scale{1};
+        uint32_t mask{0xFFFFFFFF};
+        uint8_t ram_var{NO_RAM_VAR};
+        uint8_t factor_offset{NO_FACTOR};
+
+        constexpr int32_t raw(std::span<const uint8_t> frame) const {
+            uint32_t v{};
+            for (int i = width - 1; i >= 0; --i)
+                v = (v << 8) | frame[offset + i];
+            v &= mask;
+            if (is_signed && width < 4 && ((v >> (width * 8 - 1)) & 1))
+                v |= ~0u << (width * 8);
+            return static_cast<int32_t>(v);
+        }
+        constexpr float value(std::span<const uint8_t> frame) const { return raw(frame) * scale; }
+    };
+
+    struct Frame
+    {
+        uint8_t type;
+        uint8_t min_size;
+        uint8_t max_size;
+        std::span<const Match> matches{};
+        uint8_t type_count{1}; // the frame types type to type + type_count - 1 share this layout
+
+        constexpr bool operator()(std::span<const uint8_t> frame) const {
+            if (frame.size() < min_size || frame.size() > max_size || uint8_t(frame[4] - type) >= type_count)
+                return false;
+            for (const Match &m: matches)
+                if (!m(frame))
+                    return false;
+            return true;
+        }
+    };
+
+    // 83 83 FE <nr> <device> <id> <response code> ...
+    namespace Response
+    {
+        constexpr Frame frame{.type = 0x00, .min_size = 6, .max_size = VEBUS_MAX_BUFFER_SIZE, .type_count = VEBUS_DEVICE_COUNT};
+        constexpr Field Id{.offset = 5};
+    }
+
+    // 83 83 FE 1B 20 01 01 00 04 08 00 00 00 00 C6 59 1E 00 00 7D FF (AC phase)
+    // 83 83 FE 72 20 40 A5 C4 01 0C 33 05 12 00 00 00 00 00 86 EB FF (DC)
+    namespace InfoFrame
+    {
+        constexpr Frame frame{.type = 0x20, .min_size = 20, .max_size = VEBUS_MAX_BUFFER_SIZE};
+        constexpr Field Phase{.offset = 9};
+        constexpr Field State{.offset = 8};
+        constexpr Field MainVoltage{.offset = 10, .width = 2, .is_signed = true, .ram_var = RamVariables::UBat};
+        constexpr Field MainCurrent{.offset = 12, .width = 2, .is_signed = true, .ram_var = RamVariables::IInverterRMS, .factor_offset = 5}; // BF factor
+        constexpr Field InverterVoltage{.offset = 14, .width = 2, .is_signed = true, .ram_var = RamVariables::UBat};
+        constexpr Field InverterCurrent{.offset = 16, .width = 2, .is_signed = true, .ram_var = RamVariables::IInverterRMS, .factor_offset = 6}; // Inverter factor
+        constexpr Field DcVoltage{.offset = 10, .width = 2, .is_signed = true, .ram_var = RamVariables::UBat};
+        constexpr Field DcCurrentInverting{.offset = 12, .width = 3, .is_signed = true, .ram_var = RamVariables::IBat};
+        constexpr Field DcCurrentCharging{.offset = 15, .width = 3, .is_signed = true, .ram_var = RamVariables::IBat};
+    }
+
+    namespace MasterMultiLed
+    {
+        constexpr std::array<Match, 1> matches{Match{.offset = 5, .value = 0x10}};
+        constexpr Frame frame{.type = 0x41, .min_size = 19, .max_size = 19, .matches = matches};
+        constexpr Field LEDon{.offset = 6};
+        constexpr Field LEDblink{.offset = 7};
+        constexpr Match LowBattery{.offset = 8, .value = 0x02};
+        constexpr Field AcInputConfiguration{.offset = 9};
+        constexpr Field MinimumInputCurrentLimitA{.offset = 10, .width = 2, .scale = .1f};
+        constexpr Field MaximumInputCurrentLimitA{.offset = 12, .width = 2, .scale = .1f};
+        constexpr Field ActualInputCurrentLimitA{.offset = 14, .width = 2, .scale = .1f};
+        constexpr Field SwitchRegister{.offset = 16};
+    }
+
+    namespace BatteryCondition
+    {
+        constexpr std::array<Match, 6> matches{Match{.offset = 5, .value = 0x81}, {.offset = 6, .value = 0x64}, {.offset = 7, .value = 0x14},
+                                               {.offset = 8, .value = 0xBC}, {.offset = 9, .value = 0x02}, {.offset = 12, .value = 0x00}};
+        constexpr Frame frame{.type = 0x70, .min_size = 15, .max_size = 15, .matches = matches};
+        constexpr Field BatterieAh{.offset = 10, .width = 2};
+    }
+
+    namespace ChargerInverterCondition
+    {
+        constexpr std::array<Match, 5> matches{Match{.offset = 5, .value = 0x80}, {.offset = 6, .mask = 0xFE, .value = 0x12}, {.offset = 8, .value = 0x80},
+                                               {.offset = 11, .mask = 0x10, .value = 0x10}, {.offset = 12, .value = 0x00}};
+        constexpr Frame frame{.type = 0x80, .min_size = 19, .max_size = 19, .matches = matches};
+        constexpr Match LowBattery{.offset = 7, .value = 0x02};
+        constexpr Match DcLevelAllowsInverting{.offset = 6, .mask = 0x01, .value = 0x01};
+        constexpr Field DcCurrentA{.offset = 9, .width = 2, .is_signed = true, .scale = .1f};
+        constexpr Match TempAvailable{.offset = 11, .mask = 0xF0, .value = 0x30};
+        constexpr Field Temp{.offset = 15, .scale = .1f};
+    }
+
+    namespace AcPhaseInformation
+    {
+        constexpr Frame frame{.type = 0xE4, .min_size = 21, .max_size = 21};
+        constexpr Field DcVoltage{.offset = 16, .width = 2, .scale = 1 / 50.f, .mask = 0x0FFF};
+    }
+
+    /** @brief Generates the lookup table frame type -> index into entries (NO_FRAME if not handled).
+      * Entries have to provide a pointer to their Frame layout as member layout */
+    template<typename Entry, size_t N>
+    constexpr std::array<uint8_t, 256> make_dispatch(const std::array<Entry, N> &entries) {
+        static_assert(N < NO_FRAME);
+        std::array<uint8_t, 256> dispatch{};
+        dispatch.fill(NO_FRAME);
+        for (size_t i = 0; i < N; ++i)
+            for (size_t t = 0; t < entries[i].layout->type_count; ++t)
+                dispatch[entries[i].layout->type + t] = static_cast<uint8_t>(i);
+        return dispatch;
+    }
+}
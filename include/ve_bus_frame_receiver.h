@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+/**
+ * @brief Byte driven receive state machine for VE.Bus frames
+ * <address> <address> <FD/FE> <frame nr> <stuffed payload> <checksum> FF
+ * The payload is destuffed and the checksum summed up while the bytes arrive, so a frame is
+ * validated in O(1) when its end of frame is received. As in VEBusFrameEncoder the checksum covers the
+ * transmitted bytes after the address, an escape FA 7x counts as both bytes. After a corrupt or too
+ * long frame the receiver hunts for the next end of frame and starts over, the following frames are
+ * not affected.
+ */
+template<size_t N>
+struct VEBusFrameReceiver
+{
+    enum Result : uint8_t
+    {
+        Pending,       // frame not complete yet
+        Complete,      // frame() holds a valid frame until the next push()
+        ChecksumError,
+        EscapeError,   // FA followed by a byte which is no valid escape
+        Overflow,      // frame longer than N, the rest of it is skipped
+        TooShort
+    };
+    enum State : uint8_t
+    {
+        Hunt,    // skip bytes until the next end of frame
+        Receive,
+        Escape,  // last byte was FA
+    };
+
+    static constexpr uint8_t END_OF_FRAME{0xFF};
+    static constexpr uint8_t ESCAPE{0xFA};
+    static constexpr size_t MIN_FRAME_SIZE{6}; // address, kind, nr, checksum, end of frame
+
+    std::array<uint8_t, N> buffer{};
+    size_t size{};
+    uint8_t sum{};
+    bool escapeError{};
+    bool complete{};
+    State state{State::Hunt}; // the first bytes after startup might be in the middle of a frame
+
+    /** @brief The last completed frame including checksum and end of frame, only valid until the next push() */
+    std::span<uint8_t> frame() { return {buffer.data(), size}; }
+
+    Result push(uint8_t b) {
+        if (complete) {
+            complete = false;
+            size = 0;
+            sum = 0;
+            escapeError = false;
+        }
+        switch (state) {
+        case State::Hunt:
+            if (b == END_OF_FRAME)
+                restart();
+            return Result::Pending;
+        case State::Escape:
+            state = State::Receive;
+            if (b == END_OF_FRAME) // FA directly before the end of frame is taken literally
+                return store(ESCAPE, ESCAPE) ? finish(): Result::Overflow;
+            if (b < 0x70) // escaped checksum: FA <checksum - FA>
+                return store(ESCAPE + b, ESCAPE + b) ? Result::Pending: Result::Overflow;
+            escapeError |= b > 0x7F;
+            return store(0x80 + b, ESCAPE + b) ? Result::Pending: Result::Overflow;
+        case State::Receive:
+        default:
+            if (b == END_OF_FRAME)
+                return finish();
+            if (b == ESCAPE && size >= 4) {
+                state = State::Escape;
+                return Result::Pending;
+            }
+            return store(b, b) ? Result::Pending: Result::Overflow;
+        }
+    }
+
+    /*INTERNAL*/ void restart() {
+        size = 0;
+        sum = 0;
+        escapeError = false;
+        state = State::Receive;
+    }
+
+    /** @param b destuffed byte, @param transmitted sum of the wire bytes it was received as */
+    /*INTERNAL*/ bool store(uint8_t b, uint8_t transmitted) {
+        if (size + 1 >= N) { // keep space for the end of frame
+            state = State::Hunt;
+            return false;
+        }
+        if (size >= 2)
+            sum += transmitted;
+        buffer[size++] = b;
+        return true;
+    }
+
+    /*INTERNAL*/ Result finish() {
+        if (size == 0) // idle end of frame bytes
+            return Result::Pending;
+        buffer[size++] = END_OF_FRAME;
+        complete = true;
+        if (size < MIN_FRAME_SIZE)
+            return Result::TooShort;
+        if (escapeError)
+            return Result::EscapeError;
+        if (sum != 1) // 1 - sum of all transmitted bytes after the address is the checksum
+            return Result::ChecksumError;
+        return Result::Complete;
+    }
+};
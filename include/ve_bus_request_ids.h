@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+/**
+ * @brief Request ids 0x80-0xFF of the VE.Bus data fifo with the fifo index of their entry.
+ * Allocation and lookup are constant time: a 128 bit bitmap of the used ids plus an id -> fifo index table.
+ * 0xE4-0xE7 are never handed out, Venus OS uses them.
+ * Not thread safe, VEBus guards it with _semaphoreDataFifo.
+ */
+struct ve_bus_request_ids {
+	static constexpr uint8_t FIRST{0x80};
+	static constexpr std::array<uint32_t, 4> RESERVED{0, 0, 0, 0xFu << (0xE4 - 0xE0)};
+
+	std::array<uint32_t, 4> used{};
+	std::array<uint8_t, 128> fifo_idx{};
+	uint8_t last{FIRST - 1}; // ids are handed out round robin starting after the last one
+
+	/** @brief Returns the next free id after the last one, false if all ids are in use */
+	bool next_free(uint8_t &id) {
+		uint32_t start = uint8_t(last + 1 - FIRST) & 0x7F;
+		for (uint32_t i = 0; i <= used.size(); ++i) {
+			uint32_t word = ((start >> 5) + i) % used.size();
+			uint32_t free = ~(used[word] | RESERVED[word]);
+			if (i == 0)
+				free &= ~0u << (start & 31);
+			if (!free)
+				continue;
+			last = FIRST + word * 32 + __builtin_ctz(free);
+			id = last;
+			return true;
+		}
+		return false;
+	}
+
+	/** @brief Marks id as used by the fifo entry idx, ids below FIRST are ignored */
+	void set(uint8_t id, uint8_t idx) {
+		if (id < FIRST)
+			return;
+		used[(id - FIRST) >> 5] |= 1u << (id & 31);
+		fifo_idx[id - FIRST] = idx;
+	}
+
+	void release(uint8_t id) {
+		if (id >= FIRST)
+			used[(id - FIRST) >> 5] &= ~(1u << (id & 31));
+	}
+
+	/** @brief Returns the fifo index of id or -1 if the id is not in use */
+	int find(uint8_t id) const {
+		if (id < FIRST || !(used[(id - FIRST) >> 5] & (1u << (id & 31))))
+			return -1;
+		return fifo_idx[id - FIRST];
+	}
+};
@@ -0,0 +1,423 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <span>
+
+#if PICO_ON_DEVICE
+#include <pico/time.h>
+#endif
+
+/**
+ * @brief Simulated MultiPlus (single unit, single phase) behind the rs485_serial interface.
+ * Can be used instead of rs485_serial (cmake option VEBUS_SIMULATOR) to exercise the VE.Bus
+ * driver without a MultiPlus attached, on the pico as well as in a host build, as it only depends on the standard library.
+ *
+ * The simulator is the bus master like the real device: every info.sync_period_us a sync frame is sent followed
+ * by one of the status frames (0x20 AC/DC info, 0x41 led, 0x80 charger/inverter condition, 0x70 battery condition, 0xE4 ac phase info)
+ * in round robin order. Requests written by the driver (winmon 0x00 frames and the 0x3F switch frame) are answered
+ * in the next cycle. Bytes appear in the receive ring at the configured baudrate relative to info.clock_us,
+ * so a host harness can drive the simulation deterministically with a virtual clock and has to call poll() regularly
+ * (on the pico this is done by a repeating timer like in rs485_serial).
+ */
+struct ve_bus_simulator {
+	static constexpr uint32_t RX_RING_BITS{8};
+	static constexpr uint32_t RX_RING_SIZE{1u << RX_RING_BITS};
+	static constexpr uint32_t MAX_FRAME_SIZE{64};
+	static constexpr uint32_t MAX_PENDING_FRAMES{8};
+
+	using clock_fn = uint64_t(*)();
+	using frame_cb_fn = void(*)();
+
+	// the pin members are unused, they only exist to be interchangeable with rs485_serial::rs485_info
+	struct rs485_info {
+		uint32_t baudrate{256000};
+		int tx_pin{0};
+		int rx_pin{1};
+		int en_pin{2};
+		int rx_poll_us{250};
+		uint32_t sync_period_us{20000}; // time between two sync frames
+		uint32_t status_offset_us{4000}; // start of the status frame after the sync frame
+		uint32_t response_offset_us{10000}; // start of a response after the sync frame
+		clock_fn clock_us{};
+		static rs485_info Default() {return {};}
+	};
+
+	// simulated device state, the raw values are encoded as the real device does
+	struct device_state {
+		std::array<uint16_t, 256> ram_vars{};
+		std::array<uint16_t, 256> settings{};
+		uint8_t device_state{0x09}; // inverting
+		uint8_t switch_state{0x03}; // on
+		int16_t mains_voltage{22982}; // 1/100 V
+		int16_t mains_current{120}; // 1/100 A (multiplied by the bf factor)
+		int16_t inverter_voltage{23001}; // 1/100 V
+		int16_t inverter_current{-35}; // 1/100 A (multiplied by the inverter factor)
+		int16_t dc_voltage{5331}; // 1/100 V
+		int32_t dc_current_inverting{24}; // 1/10 A
+		int32_t dc_current_charging{0}; // 1/10 A
+		uint16_t battery_ah{200};
+		uint8_t temperature{245}; // 1/10 °C
+		uint8_t led_on{0x01};
+		uint8_t led_blink{0x00};
+		bool low_battery{};
+	};
+
+	struct statistics {
+		uint32_t frames_sent{};
+		uint32_t bytes_sent{};
+		uint32_t requests_received{};
+		uint32_t responses_sent{};
+		uint32_t malformed_requests{};
+		uint32_t frames_processed{}; // frames consumed by the driver
+		uint64_t frame_latency_us_sum{}; // last byte on the wire -> frame consumed by the driver
+		uint32_t frame_latency_us_max{};
+		uint64_t frame_processing_us_sum{}; // frame callback called -> frame consumed
+		uint32_t frame_processing_us_max{};
+	};
+
+	struct frame {
+		uint64_t start_us{};
+		uint32_t size{};
+		std::array<uint8_t, MAX_FRAME_SIZE> bytes{};
+	};
+
+	rs485_info info;
+	device_state state{};
+	statistics stats{};
+
+	std::array<uint8_t, RX_RING_SIZE> rx_ring{};
+	uint32_t rx_written{}; // bytes put on the wire since startup (wraps around)
+	uint32_t rx_tail{};
+	uint32_t rx_cb_scanned{}; // bytes already checked for a delimiter by poll()
+	uint32_t rx_overruns{};
+	std::array<uint64_t, RX_RING_SIZE> rx_byte_us{}; // wire time of each byte in the ring
+	std::array<uint64_t, RX_RING_SIZE> rx_notified_us{}; // time the frame callback was called for a delimiter in the ring
+
+	std::array<frame, MAX_PENDING_FRAMES> pending{}; // frames to be sent, ordered by start_us
+	uint32_t pending_count{};
+	uint32_t pending_sent{}; // bytes of pending[0] already on the wire
+	uint64_t next_sync_us{};
+	uint8_t frame_nr{};
+	uint8_t status_idx{};
+	std::array<uint8_t, MAX_FRAME_SIZE> request{};
+	uint32_t request_size{};
+	bool response_due{};
+	std::array<uint8_t, MAX_FRAME_SIZE> response{};
+	uint32_t response_size{};
+
+	frame_cb_fn frame_cb{};
+	uint8_t frame_delimiter{0xFF};
+#if PICO_ON_DEVICE
+	repeating_timer_t rx_poll_timer{};
+#endif
+
+	ve_bus_simulator(const rs485_info &info = rs485_info::Default()): info{info} {
+		if (!this->info.clock_us)
+			this->info.clock_us = default_clock;
+		next_sync_us = now();
+	}
+	ve_bus_simulator(const ve_bus_simulator&) = delete;
+
+	static uint64_t default_clock() {
+#if PICO_ON_DEVICE
+		return time_us_64();
+#endif
+		using namespace std::chrono;
+		return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+	}
+	uint64_t now() const { return info.clock_us(); }
+	uint32_t byte_time_us() const { return std::max<uint32_t>(1, 10'000'000 / info.baudrate); }
+
+	// ----------------------------------------------------------------------------------
+	// rs485_serial interface
+	// ----------------------------------------------------------------------------------
+	void tx_flush() const {}
+	void enable_send() const {}
+	void enable_receive() const {}
+
+	uint32_t rx_head() { advance(); return rx_written; }
+
+	uint32_t rx_available() {
+		uint32_t head = rx_head();
+		if (head - rx_tail > RX_RING_SIZE) {
+			++rx_overruns;
+			rx_tail = head;
+		}
+		return head - rx_tail;
+	}
+
+	/** @brief View onto the received but not yet consumed bytes up to the end of the ring, without copying.
+	  * Bytes behind the ring end are returned by the next call after rx_consume() */
+	std::span<uint8_t> rx_contiguous() {
+		uint32_t available = rx_available();
+		uint32_t start = rx_tail & (RX_RING_SIZE - 1);
+		return {rx_ring.data() + start, std::min(available, RX_RING_SIZE - start)};
+	}
+
+	void rx_consume(uint32_t size) {
+		size = std::min(size, rx_available());
+		uint32_t last = rx_tail + size - 1;
+		if (size && rx_ring[last & (RX_RING_SIZE - 1)] == frame_delimiter) {
+			uint64_t t = now();
+			uint32_t latency = t - rx_byte_us[last & (RX_RING_SIZE - 1)];
+			++stats.frames_processed;
+			stats.frame_latency_us_sum += latency;
+			stats.frame_latency_us_max = std::max(stats.frame_latency_us_max, latency);
+			if (rx_cb_scanned - last - 1 < RX_RING_SIZE) { // the callback was already called for this frame
+				uint32_t processing = t - rx_notified_us[last & (RX_RING_SIZE - 1)];
+				stats.frame_processing_us_sum += processing;
+				stats.frame_processing_us_max = std::max(stats.frame_processing_us_max, processing);
+			}
+		}
+		rx_tail += size;
+	}
+
+	// requests of the driver, one complete frame per call (as done by VEBus::sendData)
+	void write(const uint8_t *data, size_t size) {
+		if (size < 7 || size > request.size() || data[size - 1] != 0xFF) {
+			++stats.malformed_requests;
+			return;
+		}
+		// destuff everything after the addresses (also accepts a stuffed frame kind)
+		request_size = 0;
+		for (size_t i = 0; i < size; ++i) {
+			if (i >= 2 && data[i] == 0xFA && i + 2 < size) {
+				request[request_size++] = 0x80 + data[++i];
+				continue;
+			}
+			request[request_size++] = data[i];
+		}
+		++stats.requests_received;
+		handle_request();
+	}
+
+	void register_on_frame_callback(uint8_t delimiter, frame_cb_fn cb) {
+		frame_delimiter = delimiter;
+		frame_cb = cb;
+		rx_cb_scanned = rx_written;
+#if PICO_ON_DEVICE
+		cancel_repeating_timer(&rx_poll_timer);
+		add_repeating_timer_us(-info.rx_poll_us, [](repeating_timer_t *t) { static_cast<ve_bus_simulator*>(t->user_data)->poll(); return true; }, this, &rx_poll_timer);
+#endif
+	}
+
+	/** @brief Advances the simulation to the current time and calls the frame callback if a delimiter was put on the wire */
+	void poll() {
+		advance();
+		bool frame_received{};
+		uint64_t t = now();
+		if (rx_written - rx_cb_scanned > RX_RING_SIZE)
+			rx_cb_scanned = rx_written - RX_RING_SIZE;
+		for (; rx_cb_scanned != rx_written; ++rx_cb_scanned) {
+			uint32_t idx = rx_cb_scanned & (RX_RING_SIZE - 1);
+			if (rx_ring[idx] == frame_delimiter) {
+				rx_notified_us[idx] = t;
+				frame_received = true;
+			}
+		}
+		if (frame_received && frame_cb)
+			frame_cb();
+	}
+
+	// ----------------------------------------------------------------------------------
+	// simulation
+	// ----------------------------------------------------------------------------------
+	/** @brief Puts all bytes on the wire which were transmitted until now, schedules the frames of elapsed cycles */
+	void advance() {
+		uint64_t t = now();
+		for (;;) {
+			if (pending_count == 0 || pending[0].start_us > next_sync_us) {
+				if (next_sync_us > t)
+					break;
+				schedule_cycle(next_sync_us);
+				next_sync_us += info.sync_period_us;
+				continue;
+			}
+			frame &f = pending[0];
+			if (f.start_us > t)
+				break;
+			uint32_t sent = std::min<uint64_t>(f.size, (t - f.start_us) / byte_time_us());
+			for (; pending_sent < sent; ++pending_sent) {
+				rx_ring[rx_written & (RX_RING_SIZE - 1)] = f.bytes[pending_sent];
+				rx_byte_us[rx_written & (RX_RING_SIZE - 1)] = f.start_us + (pending_sent + 1) * byte_time_us();
+				++rx_written;
+			}
+			if (pending_sent < f.size)
+				break;
+			++stats.frames_sent;
+			stats.bytes_sent += f.size;
+			std::move(pending.begin() + 1, pending.begin() + pending_count, pending.begin());
+			--pending_count;
+			pending_sent = 0;
+		}
+	}
+
+	void schedule_cycle(uint64_t sync_us) {
+		// sync frame: 83 83 FD <nr> 55 <slot> 00 00 <cs> FF
+		std::array<uint8_t, 4> sync{0x55, status_idx, 0x00, 0x00};
+		push_frame(sync_us, 0xFD, sync);
+		if (response_due) {
+			response_due = false;
+			push_frame(sync_us + info.response_offset_us, 0xFE, std::span<const uint8_t>{response.data(), response_size});
+			++stats.responses_sent;
+		}
+		push_status_frame(sync_us + info.status_offset_us);
+	}
+
+	void push_status_frame(uint64_t start_us) {
+		const device_state &s = state;
+		std::array<uint8_t, 17> b{};
+		uint32_t size{};
+		auto put16 = [&b](int i, int32_t v) { b[i] = v & 0xFF; b[i + 1] = (v >> 8) & 0xFF; };
+		auto put24 = [&b](int i, int32_t v) { b[i] = v & 0xFF; b[i + 1] = (v >> 8) & 0xFF; b[i + 2] = (v >> 16) & 0xFF; };
+		// b[0] is the frame type (byte 4 of the frame), b[i] is byte i + 4 of the frame
+		switch (status_idx) {
+		case 0: // ac info L1: 20 <bf factor> <inv factor> 00 <state> <phase> <mains U> <mains I> <inv U> <inv I> 00
+			b = {0x20, 0x01, 0x01, 0x00, s.device_state, 0x08};
+			put16(6, s.mains_voltage); put16(8, s.mains_current); put16(10, s.inverter_voltage); put16(12, s.inverter_current);
+			size = 15;
+			break;
+		case 1: // dc info: 20 40 A5 C4 01 0C <U> <I inverting 24 bit> <I charging 24 bit> 00
+			b = {0x20, 0x40, 0xA5, 0xC4, 0x01, 0x0C};
+			put16(6, s.dc_voltage); put24(8, s.dc_current_inverting); put24(11, s.dc_current_charging);
+			size = 15;
+			break;
+		case 2: // master multi led: 41 10 <on> <blink> <flags> <ac input config> <min limit> <max limit> <actual limit> <switch>
+			b = {0x41, 0x10, s.led_on, s.led_blink, uint8_t(s.low_battery ? 0x02 : 0x00), 0x01};
+			put16(6, 20); put16(8, 500); put16(10, 160);
+			b[12] = s.switch_state;
+			size = 13;
+			break;
+		case 3: { // charger inverter condition: 80 80 <12|dc ok> <low battery> 80 <I dc> 30 00 00 00 <temp> 00
+			int32_t dc_current = s.dc_current_charging - s.dc_current_inverting;
+			b = {0x80, 0x80, uint8_t(s.low_battery ? 0x12 : 0x13), uint8_t(s.low_battery ? 0x02 : 0x00), 0x80};
+			put16(5, dc_current);
+			b[7] = 0x30;
+			b[11] = s.temperature;
+			size = 13;
+			break;
+		}
+		case 4: // battery condition: 70 81 64 14 BC 02 <Ah> 00
+			b = {0x70, 0x81, 0x64, 0x14, 0xBC, 0x02};
+			put16(6, s.battery_ah);
+			size = 9;
+			break;
+		default: // ac phase information: E4 ... <dc voltage 1/50 V, 12 bit> 00
+			b = {0xE4};
+			put16(12, (s.dc_voltage * 50 / 100) & 0x0FFF);
+			size = 15;
+			break;
+		}
+		status_idx = (status_idx + 1) % 6;
+		push_frame(start_us, 0xFE, std::span<const uint8_t>{b.data(), size});
+	}
+
+	/** @brief Queues 83 83 <kind> <nr> <payload stuffed> <checksum> FF, kind is FD for sync and FE for data frames */
+	void push_frame(uint64_t start_us, uint8_t kind, std::span<const uint8_t> payload) {
+		if (pending_count == MAX_PENDING_FRAMES)
+			return;
+		if (pending_count && pending[pending_count - 1].start_us > start_us) // the bus is half duplex, frames never overlap
+			start_us = pending[pending_count - 1].start_us + pending[pending_count - 1].size * byte_time_us();
+		frame &f = pending[pending_count++];
+		f.start_us = start_us;
+		f.size = 0;
+		f.bytes[f.size++] = 0x83;
+		f.bytes[f.size++] = 0x83;
+		f.bytes[f.size++] = kind;
+		f.bytes[f.size++] = frame_nr;
+		uint8_t cs = 1 - kind - frame_nr;
+		frame_nr = (frame_nr + 1) & 0x7F;
+		// the checksum covers the transmitted (stuffed) bytes
+		for (size_t i = 0; i < payload.size() && f.size + 4 < MAX_FRAME_SIZE; ++i) {
+			uint8_t v = payload[i];
+			if (v >= 0xFA) {
+				f.bytes[f.size++] = 0xFA;
+				f.bytes[f.size++] = 0x70 | (v & 0x0F);
+				cs -= 0xFA + f.bytes[f.size - 1];
+			} else {
+				f.bytes[f.size++] = v;
+				cs -= v;
+			}
+		}
+		if (cs >= 0xFB) {
+			f.bytes[f.size++] = 0xFA;
+			f.bytes[f.size++] = cs - 0xFA;
+		} else
+			f.bytes[f.size++] = cs;
+		f.bytes[f.size++] = 0xFF;
+	}
+
+	/** @brief Prepares the response payload for the request in request[0, request_size), sent in the next cycle */
+	void handle_request() {
+		// 98 F7 FE <nr> <type> ... <cs> FF
+		if (request[2] != 0xFE) {
+			++stats.malformed_requests;
+			return;
+		}
+		uint8_t type = request[4];
+		if (type == 0x3F) { // switch state, no response
+			state.switch_state = request[5];
+			return;
+		}
+		if (type >= 4 || request_size < 9) { // winmon requests carry the device address as type
+			++stats.malformed_requests;
+			return;
+		}
+		uint8_t id = request[5];
+		uint8_t command = request[6];
+		const uint8_t *args = request.data() + 7;
+		uint32_t arg_count = request_size - 9;
+		response_size = 0;
+		auto put = [this](uint8_t v) { if (response_size < response.size()) response[response_size++] = v; };
+		auto put16 = [&put](uint16_t v) { put(v & 0xFF); put(v >> 8); };
+		put(type);
+		put(id);
+		switch (command) {
+		case 0x30: // ReadRAMVar
+			put(0x85);
+			for (uint32_t i = 0; i < arg_count; ++i)
+				put16(state.ram_vars[args[i]]);
+			break;
+		case 0x31: // ReadSetting
+			put(0x86);
+			put16(arg_count >= 1 ? state.settings[args[0]] : 0);
+			break;
+		case 0x37: // WriteViaID <flags> <address> <lo> <hi>
+			if (arg_count < 4) {
+				++stats.malformed_requests;
+				return;
+			}
+			(args[0] & 0x01 ? state.settings : state.ram_vars)[args[1]] = args[2] | (args[3] << 8);
+			put(0x87);
+			break;
+		case 0x36: // GetRAMVarInfo: <scale> <offset>
+			put(0x8E);
+			put16(0x8000 - 100);
+			put16(0);
+			break;
+		case 0x35: // GetSettingInfo: <scale> <offset> <default> <minimum> <maximum> <access level>
+			put(0x89);
+			for (int i = 0; i < 5; ++i)
+				put16(i == 0 ? 1 : 0);
+			put(0);
+			break;
+		case 0x05: // SendSoftwareVersionPart0
+			put(0x82);
+			for (int i = 0; i < 10; ++i)
+				put(0);
+			break;
+		case 0x0E: // GetSetDeviceState
+			put(0x94);
+			put(state.device_state);
+			put(0);
+			break;
+		default:
+			put(0x90); // not supported
+			break;
+		}
+		response_due = true;
+	}
+};
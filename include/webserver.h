@@ -13,10 +13,106 @@
 #include "ve_bus.h"
 #include "settings.h"
 #include "measurements.h"
+#include "time_series.h"
+#include "control_loop.h"
 
 std::string_view pb(bool b) { return b ? "true": "false"; }
 
-using tcp_server_typed = tcp_server<14, 5, 3, 0>;
+using tcp_server_typed = tcp_server<19, 5, 4, 0>;
+tcp_server_typed& Webserver();
+
+void fill_ve_ram_var(tcp_server_typed::message_buffer &res, uint32_t variable, const VEBus::ResponseData &response) {
+	res.res_set_status_line(HTTP_VERSION, response.error == VEBus::RequestError::Success ? STATUS_OK: STATUS_INTERNAL_SERVER_ERROR);
+	res.res_add_header("Server", "LacheiEmbed(josefstumpfegger@outlook.de)");
+	res.res_add_header("Content-Type", "application/json");
+	auto length_hdr = res.res_add_header("Content-Length", "        ").value; // at max 8 chars for size
+	res.res_write_body();
+	std::visit([&](auto value) {
+		res.buffer.append_formatted("{{\"id\":{},\"address\":{},\"error\":{},\"value\":{}}}", int(response.id), variable, int(response.error), value);
+	}, response.value);
+	res.res_write_body();
+	if (0 == format_to_sv(length_hdr, "{}", res.body.size()))
+		LogError("Failed to write header length");
+}
+
+/**
+ * @brief /ve_ram_var reads waiting for the VE.Bus response. The http response is deferred, the lwip context is never blocked.
+ * The VEBus completion (communication task) only stores the result and schedules flush_worker, which sends the
+ * responses from the lwip context. A read without response after TIMEOUT_MS is cancelled and answered with a timeout.
+ * start() and the workers run in the lwip context, so only the state handover from the completion needs to be atomic.
+ */
+struct ve_ram_var_reads {
+	static constexpr uint32_t TIMEOUT_MS{1000};
+	enum read_state: uint8_t { FREE, PENDING, DONE };
+	struct read {
+		std::atomic<read_state> state{FREE};
+		uint8_t id{};
+		uint32_t variable{};
+		deferred_response handle{};
+		VEBus::ResponseData response{};
+		async_at_time_worker_t timeout_worker{};
+	};
+
+	std::array<read, 4> reads{};
+	async_when_pending_worker_t flush_worker{.do_work = flush};
+	bool registered{};
+
+	static ve_ram_var_reads& Default() {
+		static ve_ram_var_reads reads{};
+		return reads;
+	}
+
+	/** @returns false if no read slot is free or the request could not be queued, nothing was deferred then */
+	bool start(uint32_t variable, tcp_server_typed::message_buffer &res) {
+		if (!registered)
+			registered = async_context_add_when_pending_worker(cyw43_arch_async_context(), &flush_worker);
+		read *r = std::find_if(reads.begin(), reads.end(), [](const read &r) { return r.state == FREE; });
+		if (!registered || r == reads.end())
+			return false;
+		r->variable = variable;
+		r->state = PENDING;
+		r->id = VEBus::Default().Read(RamVariables(variable), {complete, r});
+		if (r->id == 0) {
+			r->state = FREE;
+			return false;
+		}
+		r->handle = res.res_defer();
+		r->timeout_worker = {.do_work = timeout, .user_data = r};
+		async_context_add_at_time_worker_in_ms(cyw43_arch_async_context(), &r->timeout_worker, TIMEOUT_MS);
+		return true;
+	}
+
+	// communication task
+	static void complete(const VEBus::ResponseData &response, void *user) {
+		read &r = *static_cast<read*>(user);
+		r.response = response;
+		r.state.store(DONE, std::memory_order_release);
+		async_context_set_work_pending(cyw43_arch_async_context(), &Default().flush_worker);
+	}
+
+	// lwip context
+	static void timeout(async_context_t *context, async_at_time_worker_t *worker) {
+		read &r = *static_cast<read*>(worker->user_data);
+		if (!VEBus::Default().Cancel(r.id)) // the completion is already being called
+			return;
+		r.response = VEBus::ResponseData{.id = r.id, .command = WinmonCommand::ReadRAMVar, .address = uint8_t(r.variable), .error = VEBus::RequestError::Timeout};
+		r.state.store(DONE, std::memory_order_release);
+		flush(context, &Default().flush_worker);
+	}
+
+	// lwip context
+	static void flush(async_context_t *context, async_when_pending_worker_t *worker) {
+		for (read &r: Default().reads) {
+			if (r.state.load(std::memory_order_acquire) != DONE)
+				continue;
+			async_context_remove_at_time_worker(context, &r.timeout_worker);
+			if (!Webserver().complete_deferred(r.handle, [&r](tcp_server_typed::message_buffer &res) { fill_ve_ram_var(res, r.variable, r.response); }))
+				LogInfo("Client of /ve_ram_var/{} is gone", r.variable);
+			r.state = FREE;
+		}
+	}
+};
+
 tcp_server_typed& Webserver() {
 	const auto get_ve_infos = [] (const tcp_server_typed::message_buffer &req, tcp_server_typed::message_buffer &res) {
 		res.res_set_status_line(HTTP_VERSION, STATUS_OK);
@@ -37,6 +133,9 @@ tcp_server_typed& Webserver() {
 		MultiPlusStatus status = VEBus::Default().GetMultiPlusStatus();
 		res.buffer.append_formatted("{{\"name\":\"Multi Plus Status\",\"Temp\":{},\"DcCurrentA\":{},\"BatterieAh\":{},\"DcLevelAllowsInverting\":{}}},\n",
 			      status.Temp, status.DcCurrentA, status.BatterieAh, pb(status.DcLevelAllowsInverting));
+		VEBus::ClusterInfo cluster = VEBus::Default().GetClusterInfo();
+		res.buffer.append_formatted("{{\"name\":\"Cluster\",\"Devices\":{},\"MainPowerW\":{},\"InverterPowerW\":{},\"MinMainVoltage\":{},\"MaxMainVoltage\":{}}},\n",
+			      int(cluster.Devices), cluster.MainPowerW, cluster.InverterPowerW, cluster.MinMainVoltage, cluster.MaxMainVoltage);
 		DcInfo dc = VEBus::Default().GetDcInfo();
 		res.buffer.append_formatted("{{\"name\":\"Dc Info\",\"Voltage\":{},\"CurrentInverting\":{},\"CurrentCharging\":{}}},\n",
 			      dc.Voltage, dc.CurrentInverting, dc.CurrentCharging);
@@ -52,6 +151,138 @@ tcp_server_typed& Webserver() {
 		if (0 == format_to_sv(length_hdr, "{}", res.body.size()))
 			LogError("Failed to write header length");
 	};
+	const auto get_ve_stats = [] (const tcp_server_typed::message_buffer &req, tcp_server_typed::message_buffer &res) {
+		VEBus::Stats s = VEBus::Default().GetStats();
+		res.res_set_status_line(HTTP_VERSION, STATUS_OK);
+		res.res_add_header("Server", "LacheiEmbed(josefstumpfegger@outlook.de)");
+		res.res_add_header("Content-Type", "application/json");
+		auto length_hdr = res.res_add_header("Content-Length", "        ").value; // at max 8 chars for size
+		res.res_write_body("{\"frames\":{");
+		for (int i = 0; i < VEBus::FrameStatCount; ++i)
+			res.buffer.append_formatted("{}\"{}\":{}", i ? ",": "", VEBus::FRAME_STAT_NAMES[i], s.frames[i]);
+		res.buffer.append_formatted("}},\"rx_bytes\":{},\"tx_bytes\":{},\"bus_load_permille\":{},\"checksum_errors\":{},\"escape_errors\":{},\"short_frames\":{},\"rx_overruns\":{},\"dropped_frames\":{},"
+			"\"resends\":{},\"timeouts\":{},\"queue_high_water\":{},\"sends\":{},\"sync_to_send_avg_us\":{},\"sync_to_send_max_us\":{},"
+			"\"missed_syncs\":{},\"wake_latency_avg_us\":{},\"wake_latency_max_us\":{},\"queue_wait_ms\":{{\"buckets\":[",
+			s.rxBytes, s.txBytes, s.busLoadPermille, s.checksumErrors, s.escapeErrors, s.shortFrames, s.rxOverruns, s.droppedFrames,
+			s.resends, s.timeouts, s.queueHighWater, s.sends, s.sends ? s.syncToSendSumUs / s.sends: 0, s.syncToSendMaxUs,
+			s.missedSyncs, s.wakeups ? s.wakeLatencySumUs / s.wakeups: 0, s.wakeLatencyMaxUs);
+		// the last count of each class is above the last bucket bound
+		for (size_t i = 0; i < VEBus::QUEUE_WAIT_BUCKETS_MS.size(); ++i)
+			res.buffer.append_formatted("{}{}", i ? ",": "", VEBus::QUEUE_WAIT_BUCKETS_MS[i]);
+		res.buffer.append("]");
+		for (int p = 0; p < VEBus::PriorityCount; ++p) {
+			const VEBus::QueueWaitHistogram &h = VEBus::Default().GetQueueWaitHistogram(VEBus::RequestPriority(p));
+			res.buffer.append_formatted(",\"{}\":[", VEBus::PRIORITY_NAMES[p]);
+			for (size_t i = 0; i < h.size(); ++i)
+				res.buffer.append_formatted("{}{}", i ? ",": "", h[i]);
+			res.buffer.append("]");
+		}
+		res.buffer.append("}}");
+		res.res_write_body();
+		if (0 == format_to_sv(length_hdr, "{}", res.body.size()))
+			LogError("Failed to write header length");
+	};
+	const auto get_energy = [] (const tcp_server_typed::message_buffer &req, tcp_server_typed::message_buffer &res) {
+		energy_totals e = VEBus::Default().GetEnergy();
+		res.res_set_status_line(HTTP_VERSION, STATUS_OK);
+		res.res_add_header("Server", "LacheiEmbed(josefstumpfegger@outlook.de)");
+		res.res_add_header("Content-Type", "application/json");
+		auto length_hdr = res.res_add_header("Content-Length", "        ").value; // at max 8 chars for size
+		res.res_write_body();
+		energy_totals::pair ac_in = energy_totals::total(e.ac_in_mvas);
+		energy_totals::pair ac_out = energy_totals::total(e.ac_out_mvas);
+		res.buffer.append_formatted("{{\"dc_charged_wh\":{:.3f},\"dc_discharged_wh\":{:.3f},\"dc_charged_ah\":{:.3f},\"dc_discharged_ah\":{:.3f},"
+			"\"ac_in_imported_vah\":{:.3f},\"ac_in_exported_vah\":{:.3f},\"ac_out_vah\":{:.3f},\"ac_out_reverse_vah\":{:.3f},\"devices\":[",
+			energy_totals::wh(e.dc_mj.pos), energy_totals::wh(e.dc_mj.neg), energy_totals::ah(e.dc_mc.pos), energy_totals::ah(e.dc_mc.neg),
+			energy_totals::vah(ac_in.pos), energy_totals::vah(ac_in.neg), energy_totals::vah(ac_out.pos), energy_totals::vah(ac_out.neg));
+		// the ac counters of each device, the totals above are their sums
+		for (int device = 0; device < VEBUS_DEVICE_COUNT; ++device)
+			res.buffer.append_formatted("{}{{\"device\":{},\"ac_in_imported_vah\":{:.3f},\"ac_in_exported_vah\":{:.3f},\"ac_out_vah\":{:.3f},\"ac_out_reverse_vah\":{:.3f}}}",
+				device ? ",": "", device, energy_totals::vah(e.ac_in_mvas[device].pos), energy_totals::vah(e.ac_in_mvas[device].neg),
+				energy_totals::vah(e.ac_out_mvas[device].pos), energy_totals::vah(e.ac_out_mvas[device].neg));
+		res.buffer.append("]}");
+		res.res_write_body();
+		if (0 == format_to_sv(length_hdr, "{}", res.body.size()))
+			LogError("Failed to write header length");
+	};
+	const auto get_control_latency = [] (const tcp_server_typed::message_buffer &req, tcp_server_typed::message_buffer &res) {
+		control_loop::latency l = control_loop::Default().get_latency();
+		res.res_set_status_line(HTTP_VERSION, STATUS_OK);
+		res.res_add_header("Server", "LacheiEmbed(josefstumpfegger@outlook.de)");
+		res.res_add_header("Content-Type", "application/json");
+		auto length_hdr = res.res_add_header("Content-Length", "        ").value; // at max 8 chars for size
+		res.res_write_body();
+		res.buffer.append_formatted("{{\"setpoints\":{},\"last_us\":{},\"avg_us\":{},\"max_us\":{}}}",
+			l.count, l.last_us, l.count ? l.sum_us / l.count: 0, l.max_us);
+		res.res_write_body();
+		if (0 == format_to_sv(length_hdr, "{}", res.body.size()))
+			LogError("Failed to write header length");
+	};
+	const auto get_ve_ram_var = [] (const tcp_server_typed::message_buffer &req, tcp_server_typed::message_buffer &res) {
+		// path: /ve_ram_var/<ram variable nr>, reads a fresh value from the multiplus, the response is deferred until it arrived
+		std::string_view nr = req.path.substr(std::min(req.path.size(), std::string_view{"/ve_ram_var/"}.size()));
+		char *end{};
+		uint32_t variable = strtoul(nr.data(), &end, 10);
+		if (nr.empty() || end != nr.data() + nr.size() || variable >= RamVariables::SizeOfRamVarStruct) {
+			res.res_set_status_line(HTTP_VERSION, STATUS_BAD_REQUEST);
+			res.res_add_header("Server", "LacheiEmbed(josefstumpfegger@outlook.de)");
+			res.res_add_header("Content-Length", "0");
+			res.res_write_body();
+			return;
+		}
+		if (ve_ram_var_reads::Default().start(variable, res))
+			return;
+		res.res_set_status_line(HTTP_VERSION, STATUS_SERVICE_UNAVAILABLE);
+		res.res_add_header("Server", "LacheiEmbed(josefstumpfegger@outlook.de)");
+		res.res_add_header("Content-Length", "0");
+		res.res_write_body();
+	};
+	const auto get_history = [] (const tcp_server_typed::message_buffer &req, tcp_server_typed::message_buffer &res) {
+		// path: /history/<resolution_s>[/<from_s>[/<to_s>]], times are uptime seconds,
+		// answers at max one page of samples, the next page is requested with from_s = next
+		std::string_view args = req.path.substr(std::min(req.path.size(), std::string_view{"/history/"}.size()));
+		std::array<uint32_t, 3> vals{0, 0, std::numeric_limits<uint32_t>::max()};
+		for (uint32_t &val: vals) {
+			if (args.empty())
+				break;
+			val = strtoul(args.data(), nullptr, 10);
+			args = args.substr(std::min(args.size(), args.find('/') + 1));
+		}
+		if (!time_series::has_resolution(vals[0])) {
+			res.res_set_status_line(HTTP_VERSION, STATUS_BAD_REQUEST);
+			res.res_add_header("Server", "LacheiEmbed(josefstumpfegger@outlook.de)");
+			res.res_add_header("Content-Length", "0");
+			res.res_write_body();
+			return;
+		}
+		res.res_set_status_line(HTTP_VERSION, STATUS_OK);
+		res.res_add_header("Server", "LacheiEmbed(josefstumpfegger@outlook.de)");
+		res.res_add_header("Content-Type", "application/json");
+		auto length_hdr = res.res_add_header("Content-Length", "        ").value; // at max 8 chars for size
+		res.res_write_body();
+		res.buffer.append_formatted("{{\"resolution_s\":{},\"now\":{},\"channels\":[", vals[0], time_us_64() / 1000000);
+		for (int c = 0; c < HISTORY_CHANNELS; ++c)
+			res.buffer.append_formatted("{}{{\"name\":\"{}\",\"scale\":{}}}", c ? ",": "", HISTORY_CHANNEL_NAMES[c], 1 / HISTORY_CHANNEL_SCALES[c]);
+		res.buffer.append("],\"samples\":[");
+		uint32_t from{}, count{};
+		uint32_t next = time_series::Default().for_each(vals[0], vals[1], vals[2], [&](uint32_t start, const history_sample &s) {
+			if (count++ == 0)
+				from = start;
+			else
+				res.buffer.append(',');
+			if (!s.valid()) {
+				res.buffer.append("null");
+				return;
+			}
+			for (int c = 0; c < HISTORY_CHANNELS; ++c) // [min,max,mean] per channel
+				res.buffer.append_formatted("{}{},{},{}", c ? ",": "[", s.min[c], s.max[c], s.mean[c]);
+			res.buffer.append(']');
+		});
+		res.buffer.append_formatted("],\"from\":{},\"next\":{}}}", from, next);
+		res.res_write_body();
+		if (0 == format_to_sv(length_hdr, "{}", res.body.size()))
+			LogError("Failed to write header length");
+	};
 	const auto get_ui_settings = [] (const tcp_server_typed::message_buffer &req, tcp_server_typed::message_buffer &res) {
 		res.res_set_status_line(HTTP_VERSION, STATUS_OK);
 		res.res_add_header("Server", "LacheiEmbed(josefstumpfegger@outlook.de)");
@@ -69,14 +300,43 @@ tcp_server_typed& Webserver() {
 		res.res_add_header("Content-Type", "text/plain");
 		res.res_add_header("Content-Length", "0");
 		settings::Default().parse_from_json(req.body);
+		control_loop::Default().trigger();
+	};
+	const auto put_external_w = [] (const tcp_server_typed::message_buffer &req, tcp_server_typed::message_buffer &res) {
+		// body: power in W, positive for discharging the battery, wakes the control loop directly
+		char *end{};
+		float w = strtof(req.body.data(), &end);
+		bool valid = end != req.body.data() && std::isfinite(w);
+		if (valid) {
+			settings::Default().external_w = w;
+			control_loop::Default().trigger();
+		}
+		res.res_set_status_line(HTTP_VERSION, valid ? STATUS_OK: STATUS_BAD_REQUEST);
+		res.res_add_header("Server", "LacheiEmbed(josefstumpfegger@outlook.de)");
+		res.res_add_header("Content-Length", "0");
+		res.res_write_body();
 	};
-	const auto static_page_callback = [] (std::string_view page, std::string_view status, std::string_view type = "text/html") {
+	const auto static_page_callback = [] (embedded_file page, std::string_view status, std::string_view type = "text/html") {
 		return [page, status, type](const tcp_server_typed::message_buffer &req, tcp_server_typed::message_buffer &res){
+			// pre-compressed variants are served if the client accepts them, identity is the fallback
+			std::string_view accept_encoding = req.headers_view.get_header("Accept-Encoding");
+			std::string_view encoding{};
+			std::string_view body{page.identity};
+			if (!page.br.empty() && accepts_encoding(accept_encoding, "br")) {
+				encoding = "br";
+				body = page.br;
+			} else if (!page.gzip.empty() && accepts_encoding(accept_encoding, "gzip")) {
+				encoding = "gzip";
+				body = page.gzip;
+			}
 			res.res_set_status_line(HTTP_VERSION, status);
 			res.res_add_header("Server", "LacheiEmbed(josefstumpfegger@outlook.de)");
 			res.res_add_header("Content-Type", type);
-			res.res_add_header("Content-Length", static_format<8>("{}", page.size()));
-			res.res_write_body(page);
+			if (!encoding.empty())
+				res.res_add_header("Content-Encoding", encoding);
+			res.res_add_header("Vary", "Accept-Encoding");
+			res.res_add_header("Content-Length", static_format<8>("{}", body.size()));
+			res.res_set_static_body(body); // sent directly from flash
 		};
 	};
 	const auto fill_unauthorized = [] (const tcp_server_typed::message_buffer &req, tcp_server_typed::message_buffer &res) {
@@ -253,10 +513,15 @@ tcp_server_typed& Webserver() {
 	};
 	static tcp_server_typed webserver{
 		.port = 80,
-		.default_endpoint_cb = static_page_callback(_404_HTML, STATUS_NOT_FOUND),
+		.default_endpoint_cb = static_page_callback(_404_HTML_FILE, STATUS_NOT_FOUND),
 		.get_endpoints = {
 			tcp_server_typed::endpoint{{.path_match = true}, "/ui_settings", get_ui_settings},
 			tcp_server_typed::endpoint{{.path_match = true}, "/ve_infos", get_ve_infos},
+			tcp_server_typed::endpoint{{.path_match = true}, "/ve_stats", get_ve_stats},
+			tcp_server_typed::endpoint{{.path_match = true}, "/energy", get_energy},
+			tcp_server_typed::endpoint{{.path_match = true}, "/control_latency", get_control_latency},
+			tcp_server_typed::endpoint{{.path_match = false}, "/ve_ram_var/", get_ve_ram_var},
+			tcp_server_typed::endpoint{{.path_match = false}, "/history/", get_history},
 			// interactive endpoints
 			tcp_server_typed::endpoint{{.path_match = true}, "/logs", get_logs},
 			tcp_server_typed::endpoint{{.path_match = true}, "/discovered_wifis", get_discovered_wifis},
@@ -267,12 +532,12 @@ tcp_server_typed& Webserver() {
 			// time endpoint
 			tcp_server_typed::endpoint{{.path_match = true}, "/time", get_time},
 			// static file serve endpoints
-			tcp_server_typed::endpoint{{.path_match = true}, "/", static_page_callback(INDEX_HTML, STATUS_OK)},
-			tcp_server_typed::endpoint{{.path_match = true}, "/index.html", static_page_callback(INDEX_HTML, STATUS_OK)},
-			tcp_server_typed::endpoint{{.path_match = true}, "/style.css", static_page_callback(STYLE_CSS, STATUS_OK, "text/css")},
-			tcp_server_typed::endpoint{{.path_match = true}, "/internet.html", static_page_callback(INTERNET_HTML, STATUS_OK)},
-			tcp_server_typed::endpoint{{.path_match = true}, "/overview.html", static_page_callback(OVERVIEW_HTML, STATUS_OK)},
-			tcp_server_typed::endpoint{{.path_match = true}, "/settings.html", static_page_callback(SETTINGS_HTML, STATUS_OK)},
+			tcp_server_typed::endpoint{{.path_match = true}, "/", static_page_callback(INDEX_HTML_FILE, STATUS_OK)},
+			tcp_server_typed::endpoint{{.path_match = true}, "/index.html", static_page_callback(INDEX_HTML_FILE, STATUS_OK)},
+			tcp_server_typed::endpoint{{.path_match = true}, "/style.css", static_page_callback(STYLE_CSS_FILE, STATUS_OK, "text/css")},
+			tcp_server_typed::endpoint{{.path_match = true}, "/internet.html", static_page_callback(INTERNET_HTML_FILE, STATUS_OK)},
+			tcp_server_typed::endpoint{{.path_match = true}, "/overview.html", static_page_callback(OVERVIEW_HTML_FILE, STATUS_OK)},
+			tcp_server_typed::endpoint{{.path_match = true}, "/settings.html", static_page_callback(SETTINGS_HTML_FILE, STATUS_OK)},
 		},
 		.post_endpoints = {
 			tcp_server_typed::endpoint{{.path_match = true}, "/set_log_level", set_log_level},
@@ -285,6 +550,7 @@ tcp_server_typed& Webserver() {
 			tcp_server_typed::endpoint{{.path_match = true}, "/set_password", set_password},
 			tcp_server_typed::endpoint{{.path_match = true}, "/time", set_time},
 			tcp_server_typed::endpoint{{.path_match = true}, "/ui_settings", put_ui_settings},
+			tcp_server_typed::endpoint{{.path_match = true}, "/external_w", put_external_w},
 		}
 	};
 	return webserver;
@@ -22,6 +22,8 @@
 #include "usb_interface.h"
 #include "settings.h"
 #include "measurements.h"
+#include "time_series.h"
+#include "control_loop.h"
 #include "crypto_storage.h"
 #include "ntp_client.h"
 #include "ve_bus.h"
@@ -29,9 +31,19 @@
 #define TEST_TASK_PRIORITY ( tskIDLE_PRIORITY + 1UL )
 
 constexpr UBaseType_t STANDARD_TASK_PRIORITY = tskIDLE_PRIORITY + 1ul;
-constexpr UBaseType_t CONTROL_TASK_PRIORITY = tskIDLE_PRIORITY + 10ul;
+constexpr UBaseType_t CONTROL_TASK_PRIORITY = VEBUS_TASK_PRIORITY - 1; // below the bus task so frames are never delayed by the control loop
+// bus receive, decode and control run on the realtime core, networking, http, usb and flash on the other one
+constexpr UBaseType_t REALTIME_CORE_MASK = 1 << VEBUS_TASK_CORE;
+constexpr UBaseType_t NETWORK_CORE_MASK = 1 << (1 - VEBUS_TASK_CORE);
 constexpr uint GPIO_POWER = 26;
 constexpr uint GPIO_MIN_CAP = 27;
+constexpr uint32_t CONTROL_PERIOD_MS = 2000; // at the latest, new setpoints and dc data wake the loop earlier
+constexpr uint32_t CONTROL_MIN_PERIOD_MS = 100; // rate limit for event triggered iterations
+constexpr float CONTROL_DC_DEADBAND_V = .05f; // smaller battery voltage changes wait for the periodic iteration
+constexpr uint32_t CONTROL_MODE_HOLD_MS = 5000; // minimum time between two switch mode changes
+constexpr uint32_t ENERGY_SAVE_INTERVAL_S = 15 * 60; // with a 2 sector log each sector is erased about 3 times a day
+
+using energy_log_t = persistent_log<energy_totals>;
 
 uint32_t time_ms() { return time_us_64() / 1000; }
 uint32_t time_s() { return time_us_64() / 1000000; }
@@ -83,10 +95,26 @@ void vebus_comm_task(void *) {
     LogInfo("Starting VEBus comm monitor task");
 
     // note that all readout and setting of vebus information is done in webserver.h
+    // responses and timeouts are handled event driven by the VEBus communication task,
+    // this task only keeps the watchdog alive, samples the measurement history and does the flash writes
+    // (on the network core, so the realtime core is only stalled for the flash operation itself)
+    settings &sets = settings::Default();
+    uint32_t last_energy_save_s = time_s();
     for (;;) {
         watchdog_update(); 
-        VEBus::Default().Maintain();
-        vTaskDelay(pdMS_TO_TICKS(10));
+        if (settings::changed) {
+            settings::changed = false;
+            persistent_storage_t::Default().write(sets, &persistent_storage_layout::sets);
+        }
+        if (time_s() - last_energy_save_s >= ENERGY_SAVE_INTERVAL_S) {
+            last_energy_save_s = time_s();
+            if (PICO_OK != energy_log_t::Default().append(VEBus::Default().GetEnergy()))
+                LogError("Failed to store energy counters");
+        }
+        time_series::Default().add(time_s(), {VEBus::Default().GetDcInfo().Voltage,
+                                              VEBus::Default().GetMultiPlusStatus().DcCurrentA,
+                                              VEBus::Default().GetClusterInfo().MainPowerW});
+        vTaskDelay(pdMS_TO_TICKS(100));
     }
 }
 
@@ -103,11 +131,13 @@ void victron_control_task(void *) {
     settings &sets = settings::Default();
     sets.external_w = 0;
     uint32_t last_iter_ms = time_ms();
+    SwitchState last_mode{SwitchState::Sleep};
+    uint32_t last_mode_change_ms = last_iter_ms - CONTROL_MODE_HOLD_MS;
+    i32 last_power{INT32_MIN};
+    control_loop::Default().task = xTaskGetCurrentTaskHandle();
 
     for (;;) {
-        if (settings::changed)
-		persistent_storage_t::Default().write(sets, &persistent_storage_layout::sets);
-        settings::changed = false;
+        uint32_t trigger_us = control_loop::Default().take_trigger();
 
         sets.local_w = read_pot(GPIO_POWER) * 6000;
         sets.local_min_v = soc_to_v(read_pot(GPIO_MIN_CAP) * 100);
@@ -155,11 +185,33 @@ void victron_control_task(void *) {
             }
         }
 
-        LogInfo("Switch mode to {:x}", (int)cur_mode);
+        if (cur_mode != last_mode) {
+            if (cur_ms - last_mode_change_ms < CONTROL_MODE_HOLD_MS) {
+                cur_mode = last_mode;
+            } else {
+                LogInfo("Switch mode to {:x}", (int)cur_mode);
+                last_mode = cur_mode;
+                last_mode_change_ms = cur_ms;
+            }
+        }
         VEBus::Default().SetSwitch(cur_mode);
-        LogInfo("Set power to {}", cur_power);
-        VEBus::Default().SetPower(i16(cur_power));
-        vTaskDelay(pdMS_TO_TICKS(2000)); // do the loop every 2 seconds
+        i32 power = i32(cur_power);
+        VEBus::Completion completion{};
+        if (power != last_power) {
+            LogInfo("Set power to {}", power);
+            if (trigger_us) // measure the latency from the event until the acknowledge of the new setpoint
+                completion = {[](const VEBus::ResponseData &response, void *user) {
+                    control_loop::on_setpoint_acknowledged(response.error == VEBus::RequestError::Success, user);
+                }, reinterpret_cast<void*>(uintptr_t(trigger_us))};
+            last_power = power;
+        }
+        VEBus::Default().SetClusterPower(power, completion);
+
+        // woken by control_loop::trigger(), at the latest after CONTROL_PERIOD_MS
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONTROL_PERIOD_MS));
+        uint32_t iter_ms = time_ms() - cur_ms;
+        if (iter_ms < CONTROL_MIN_PERIOD_MS)
+            vTaskDelay(pdMS_TO_TICKS(CONTROL_MIN_PERIOD_MS - iter_ms));
     }
 }
 
@@ -180,6 +232,10 @@ void startup_task(void *) {
     wifi_storage::Default().update_scanned();
     Webserver().start();
     LogInfo("Ready, running http at {}", ip4addr_ntoa(netif_ip4_addr(netif_list)));
+    energy_totals energy{};
+    if (energy_log_t::Default().read(energy))
+        VEBus::Default().RestoreEnergy(energy);
+    VEBus::Default().OnDcInfo([](const DcInfo &info, void *) { control_loop::Default().trigger_on_change(info.Voltage, CONTROL_DC_DEADBAND_V); });
     VEBus::Default().Setup(); // creates a separate thread
     persistent_storage_t::Default().read(&persistent_storage_layout::sets, settings::Default());
     settings::Default().sanitize(); // will make sure that no garbage is loaded from storage
@@ -187,10 +243,10 @@ void startup_task(void *) {
     std::cout << "Initialization done, get all further info via the commands shown in 'help'\n";
     cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
 
-    xTaskCreate(usb_comm_task, "UsbComm", 512, NULL, 1, NULL); // usb task also has to be started only after cyw43 init as some wifi functions are available
-    xTaskCreate(wifi_search_task, "UpdateWifi", 512, NULL, 1, NULL);
-    xTaskCreate(vebus_comm_task, "VEBusComm", 2048, NULL, 8, NULL);
-    xTaskCreate(victron_control_task, "VictronControl", 2048, NULL, 8, NULL);
+    xTaskCreateAffinitySet(usb_comm_task, "UsbComm", 512, NULL, 1, NETWORK_CORE_MASK, NULL); // usb task also has to be started only after cyw43 init as some wifi functions are available
+    xTaskCreateAffinitySet(wifi_search_task, "UpdateWifi", 512, NULL, 1, NETWORK_CORE_MASK, NULL);
+    xTaskCreateAffinitySet(vebus_comm_task, "VEBusComm", 2048, NULL, 8, NETWORK_CORE_MASK, NULL);
+    xTaskCreateAffinitySet(victron_control_task, "VictronControl", 2048, NULL, CONTROL_TASK_PRIORITY, REALTIME_CORE_MASK, NULL);
     cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 0);
     vTaskDelete(NULL); // remove this task for efficiency reasions
 }
@@ -19,17 +19,18 @@
 #define DATA_FRAME 0xFE
 #define END_OF_FRAME 0xFF
 #define LOW_BATTERY 0x02
+#define SWITCH_STATE_FRAME 0x3F
+#define SET_POWER_ADDRESS 0x83
 
 void commandHandling(VEBus &ve_bus);
-void fill_command_buffer(VEBusBuffer &buffer, uint8_t id, uint8_t winmonCommand, StorageType storageType, uint8_t address, uint8_t lowByte, uint8_t highByte);
-uint8_t prepareCommandReadMultiRAMVar(VEBusBuffer &buffer, uint8_t id, uint8_t* addresses, uint8_t addressSize);
-void prepareCommandReadSetting(VEBusBuffer &buffer, uint8_t id, uint16_t address);
+void fill_command_buffer(VEBusBuffer &buffer, uint8_t device, uint8_t id, uint8_t winmonCommand, StorageType storageType, uint8_t address, uint8_t lowByte, uint8_t highByte);
+uint8_t prepareCommandReadMultiRAMVar(VEBusBuffer &buffer, uint8_t device, uint8_t id, uint8_t* addresses, uint8_t addressSize);
+void prepareCommandReadSetting(VEBusBuffer &buffer, uint8_t device, uint8_t id, uint16_t address);
 void prepareCommandWriteAddress(VEBusBuffer &buffer, uint8_t id, uint8_t winmonCommand, uint16_t address);
-void prepareCommandReadInfo(VEBusBuffer& buffer, uint8_t id, uint8_t winmonCommand, uint16_t setting);
+void prepareCommandReadInfo(VEBusBuffer& buffer, uint8_t device, uint8_t id, uint8_t winmonCommand, uint16_t setting);
 void prepareCommandSetSwitchState(VEBusBuffer& buffer, SwitchState switchState);
-void prepareCommandReadSoftwareVersion(VEBusBuffer& buffer, uint8_t id, uint8_t winmonCommand);;
-void prepareCommandSetGetDeviceState(VEBusBuffer& buffer, uint8_t id, CommandDeviceState command, uint8_t state = 0);
-void appendChecksum(std::vector<uint8_t>& buffer);
+void prepareCommandReadSoftwareVersion(VEBusBuffer& buffer, uint8_t device, uint8_t id, uint8_t winmonCommand);
+void prepareCommandSetGetDeviceState(VEBusBuffer& buffer, uint8_t device, uint8_t id, CommandDeviceState command, uint8_t state = 0);
 uint16_t convertRamVarToRawValue(RamVariables variable, float value, const RAMVarInfos &ramVarInfoList);
 float convertRamVarToValue(RamVariables variable, uint16_t rawValue, const RAMVarInfos &ramVarInfoList);
 int16_t convertRamVarToRawValueSigned(RamVariables variable, float value, const RAMVarInfos &ramVarInfoList);
@@ -38,9 +39,9 @@ uint16_t convertSettingToRawValue(Settings setting, float value, const SettingIn
 float convertSettingToValue(Settings setting, uint16_t rawValue, const SettingInfos &settingInfoList);
 
 TaskHandle_t vebus_comm_task_handle{};
-Serial *serial{};
-void on_uart_receive() {
-	serial->enable_receive_callback(false);
+volatile uint32_t frame_notified_us{}; // time of the last frame notification, base of the sync to send latency
+void on_frame_received() {
+        frame_notified_us = time_us_32();
         BaseType_t xHigherPriorityTaskWoken = pdFALSE;
         vTaskNotifyGiveFromISR(vebus_comm_task_handle, &xHigherPriorityTaskWoken);
 	portYIELD_FROM_ISR( xHigherPriorityTaskWoken );
@@ -50,15 +51,16 @@ void VEBusDefinition::communication_task(void* handler_args)
 {
 	VEBus *ve_bus = static_cast<VEBus*>(handler_args);
 	vebus_comm_task_handle = xTaskGetCurrentTaskHandle();
-	serial = &ve_bus->serial;
-	ve_bus->serial.register_on_receive_callback(on_uart_receive);
+	ve_bus->serial.register_on_frame_callback(END_OF_FRAME, on_frame_received);
 
 	while (true)
 	{
-		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(20)); // wait at max 20ms for new packet
-		while (!ve_bus->commandHandling() || serial->rx_available()) // processing is done for as long as the commandHandling is not yet done
-			taskYIELD(); // allow other threads to continue some work
-		serial->enable_receive_callback(true); // only after command handling is done re-enable the interrupt
+		// woken as soon as a full frame was received, at the latest when the next response times out
+		if (ulTaskNotifyTake(pdTRUE, ve_bus->ticksUntilResponseTimeout()))
+			ve_bus->countWakeup(time_us_32() - frame_notified_us);
+		while (ve_bus->commandHandling()); // process all frames that are waiting in the receive ring, responses are completed directly
+		ve_bus->checkResponseTimeout();
+		ve_bus->publishStats();
 	}
 }
 
@@ -79,8 +81,6 @@ std::string_view VEBusDefinition::to_sv(PhaseInfo phase) {
 VEBus::VEBus(Serial& serial) : serial(serial)
 {
 	_semaphoreDataFifo = xSemaphoreCreateMutex();
-	_semaphoreStatus = xSemaphoreCreateMutex();
-	_semaphoreReceiveData = xSemaphoreCreateMutex();
 }
 
 VEBus::~VEBus()
@@ -90,21 +90,8 @@ VEBus::~VEBus()
 void VEBus::Setup(bool autostart)
 {
 	if (autostart) StartCommunication();
-	xTaskCreate(communication_task, "vebus_task", 4096, this, 8, NULL);
-}
-
-void VEBus::Maintain()
-{
-	checkResponseTimeout();
-	checkResponseMessage();
-
-	xSemaphoreTake(_semaphoreReceiveData, VEBUS_MAX_SEM_DELAY);
-	if (receive_cb)
-		for (VEBusBuffer &d: _receiveBufferList)
-			receive_cb(d);
-	_receiveBufferList.clear();
-
-	xSemaphoreGive(_semaphoreReceiveData);
+	// pinned, so the alarm irq of the receive poll timer (registered by the task) is on the same core
+	xTaskCreateAffinitySet(communication_task, "vebus_task", 4096, this, VEBUS_TASK_PRIORITY, 1 << VEBUS_TASK_CORE, NULL);
 }
 
 void VEBus::StartCommunication()
@@ -119,7 +106,7 @@ void VEBus::StopCommunication()
 	_communitationIsRunning = false;
 }
 
-VEBus::RequestResult VEBus::WriteViaID(RamVariables variable, val_var value, bool eeprom)
+VEBus::RequestResult VEBus::WriteViaID(RamVariables variable, val_var value, bool eeprom, Completion completion)
 {
 	if (!_ramVarInfoList[variable].available) 
 		return {0 , RequestError::ConvertError };
@@ -147,20 +134,21 @@ VEBus::RequestResult VEBus::WriteViaID(RamVariables variable, val_var value, boo
 		LogError("WTF");
 
 	Data data;
-	if (!getNextFreeId_1(data.id)) 
-		return {0 , RequestError::FifoFull };
 	data.responseExpected = true;
+	data.priority = RequestPriority::Realtime;
 	data.command = WinmonCommand::WriteRAMVar;
 	data.address = variable;
 	data.expectedResponseCode = 0x87;
 	StorageType storageType = (eeprom == false) ? StorageType::NoEeprom : StorageType::Eeprom;
-	fill_command_buffer(data.requestData, data.id, data.command, storageType, variable, lowByte, highByte);
-	addOrUpdateFifo(data);
+	fill_command_buffer(data.requestData, data.device, data.id, data.command, storageType, variable, lowByte, highByte);
+	data.completion = completion;
+	if (!addOrUpdateFifo(data))
+		return {0 , RequestError::FifoFull };
 	return { data.id , RequestError::Success };
 }
 
 
-VEBus::RequestResult VEBus::WriteViaID(Settings setting, val_var value, bool eeprom)
+VEBus::RequestResult VEBus::WriteViaID(Settings setting, val_var value, bool eeprom, Completion completion)
 {
 	uint8_t lowByte{};
 	uint8_t highByte{};
@@ -177,15 +165,16 @@ VEBus::RequestResult VEBus::WriteViaID(Settings setting, val_var value, bool eep
 		if (_settingInfoList[setting].Minimum > rawValue) return {0, RequestError::OutsideLowerRange};
 	}
 	Data data;
-	if (!getNextFreeId_1(data.id)) 
-		return {0 , RequestError::FifoFull };
 	data.responseExpected = true;
+	data.priority = RequestPriority::Background;
 	data.command = WinmonCommand::WriteSetting;
 	data.address = setting;
 	data.expectedResponseCode = 0x87;
 	StorageType storageType = (eeprom == false) ? StorageType::NoEeprom : StorageType::Eeprom;
-	fill_command_buffer(data.requestData, data.id, data.command, storageType, setting, lowByte, highByte);
-	addOrUpdateFifo(data);
+	fill_command_buffer(data.requestData, data.device, data.id, data.command, storageType, setting, lowByte, highByte);
+	data.completion = completion;
+	if (!addOrUpdateFifo(data))
+		return {0 , RequestError::FifoFull };
 	return { data.id , RequestError::Success };
 }
 
@@ -193,34 +182,107 @@ VEBus::RequestResult VEBus::WriteViaID(Settings setting, val_var value, bool eep
 // 	int i = 0;
 // 	LogFatal("buffer(:8): {:02x}, {:02x}, {:02x}, {:02x}, {:02x}, {:02x}, {:02x}, {:02x}", buffer.storage[i++], buffer.storage[i++], buffer.storage[i++], buffer.storage[i++], buffer.storage[i++], buffer.storage[i++], buffer.storage[i++], buffer.storage[i++]);
 // }
-VEBus::RequestResult VEBus::SetPower(i16 power_w)
+VEBus::RequestResult VEBus::SetPower(i16 power_w, Completion completion, uint8_t device)
 {
+	if (device >= VEBUS_DEVICE_COUNT)
+		return { 0, RequestError::OutsideUpperRange };
 	uint8_t lowByte = power_w & 0xff;
 	uint8_t highByte = power_w >> 8;
+	xSemaphoreTake(_semaphoreDataFifo, portMAX_DELAY);
+	Data *pending{};
+	bool inFlight{};
+	for (Data &element: _dataFifo) {
+		if (element.command != WinmonCommand::WriteRAMVar || element.address != SET_POWER_ADDRESS || element.device != device)
+			continue;
+		// an acknowledgement of a resent write might still belong to the previous value
+		if (element.IsSent || element.resendCount)
+			inFlight = true;
+		else
+			pending = &element;
+	}
+	// a not yet sent power write only gets the value bytes patched, a new completion supersedes the queued one
+	if (pending) {
+		pending->requestData[5] = lowByte;
+		pending->requestData[6] = highByte;
+		Data superseded{};
+		if (completion.cb) {
+			superseded = *pending;
+			pending->completion = completion;
+		}
+		uint8_t id = pending->id;
+		xSemaphoreGive(_semaphoreDataFifo);
+		completeWithError(superseded, RequestError::Superseded);
+		return { id, RequestError::Success };
+	}
+	// the device already has this value and it was written recently
+	const WriteCache &cache = _powerWrite[device];
+	if (!completion.cb && !inFlight && cache.valid && cache.value == uint16_t(power_w) && millis() - cache.timeMs < VEBUS_WRITE_KEEPALIVE_MS) {
+		xSemaphoreGive(_semaphoreDataFifo);
+		return { 0, RequestError::Success };
+	}
+	xSemaphoreGive(_semaphoreDataFifo);
+
 	Data data;
-	if (!getNextFreeId_1(data.id)) 
-		return {0 , RequestError::FifoFull };
 	data.responseExpected = true;
+	data.priority = RequestPriority::Realtime;
 	data.command = WinmonCommand::WriteRAMVar;
-	data.address = 0x83;
+	data.address = SET_POWER_ADDRESS;
+	data.device = device;
 	data.expectedResponseCode = 0x87;
 	StorageType storageType =  StorageType::NoEeprom;
-	fill_command_buffer(data.requestData, data.id, data.command, storageType, data.address, lowByte, highByte);
-	addOrUpdateFifo(data);
+	fill_command_buffer(data.requestData, data.device, data.id, data.command, storageType, data.address, lowByte, highByte);
+	data.completion = completion;
+	if (!addOrUpdateFifo(data))
+		return {0 , RequestError::FifoFull };
 	return { data.id , RequestError::Success };
 }
 
-uint8_t VEBus::Read(RamVariables variable)
+VEBus::RequestResult VEBus::SetClusterPower(i32 power_w, Completion completion)
+{
+	// split evenly, device 0 gets the remainder
+	i32 part = power_w / VEBUS_DEVICE_COUNT;
+	RequestResult result{};
+	for (uint8_t device = VEBUS_DEVICE_COUNT; device-- > 0;) {
+		i32 device_w = std::clamp<i32>(device == 0 ? power_w - part * (VEBUS_DEVICE_COUNT - 1): part, INT16_MIN, INT16_MAX);
+		result = SetPower(i16(device_w), device == 0 ? completion: Completion{}, device);
+		if (result.error != RequestError::Success)
+			return result;
+	}
+	return result;
+}
+
+uint8_t VEBus::Read(RamVariables variable, Completion completion, uint8_t device)
 {
+	// coalesce with a pending read which was not sent yet
+	xSemaphoreTake(_semaphoreDataFifo, portMAX_DELAY);
+	for (Data &element: _dataFifo) {
+		if (completion.cb || element.completion.cb || element.command != WinmonCommand::ReadRAMVar || element.IsSent || element.device != device)
+			continue;
+		uint8_t id = element.id;
+		if (std::find(element.addresses.begin(), element.addresses.end(), variable) != element.addresses.end()) {
+			xSemaphoreGive(_semaphoreDataFifo);
+			return id;
+		}
+		if (element.addresses.push(variable)) {
+			prepareCommandReadMultiRAMVar(element.requestData, element.device, id, element.addresses.begin(), element.addresses.size());
+			xSemaphoreGive(_semaphoreDataFifo);
+			return id;
+		}
+	}
+	xSemaphoreGive(_semaphoreDataFifo);
+
 	Data data;
-	if (!getNextFreeId_1(data.id)) return 0;
 	data.responseExpected = true;
+	data.priority = RequestPriority::Telemetry;
 	data.command = WinmonCommand::ReadRAMVar;
 	data.address = variable;
+	data.device = device;
 	data.expectedResponseCode = 0x85;
-	uint8_t address[] = { variable };
-	prepareCommandReadMultiRAMVar(data.requestData, data.id, address, 1);
-	addOrUpdateFifo(data);
+	data.addresses.push(variable);
+	prepareCommandReadMultiRAMVar(data.requestData, data.device, data.id, data.addresses.begin(), data.addresses.size());
+	data.completion = completion;
+	if (!addOrUpdateFifo(data))
+		return 0;
 	return data.id;
 }
 
@@ -229,52 +291,204 @@ uint8_t VEBus::Read(RamVariables variable)
 // <Value> is an unsigned 16 - bit quantity.  
 // 0x86 = SettingReadOK. 
 // 0x91 = Setting not supported(in which case <Value> is not valid).
-uint8_t VEBus::Read(Settings setting)
+uint8_t VEBus::Read(Settings setting, Completion completion, uint8_t device)
 {
 	Data data;
-	if (!getNextFreeId_1(data.id)) return 0;
 	data.responseExpected = true;
+	data.priority = RequestPriority::Telemetry;
 	data.command = WinmonCommand::ReadSetting;
 	data.address = setting;
+	data.device = device;
 	data.expectedResponseCode = 0x86;
-	prepareCommandReadSetting(data.requestData, data.id, setting);
-	addOrUpdateFifo(data);
+	prepareCommandReadSetting(data.requestData, data.device, data.id, setting);
+	data.completion = completion;
+	if (!addOrUpdateFifo(data))
+		return 0;
 	return data.id;
 }
 
-uint8_t VEBus::ReadInfo(RamVariables variable)
+uint8_t VEBus::ReadInfo(RamVariables variable, Completion completion, uint8_t device)
 {
 	Data data;
-	if (!getNextFreeId_1(data.id)) return 0;
 	data.responseExpected = true;
+	data.priority = RequestPriority::Background;
 	data.command = WinmonCommand::GetRAMVarInfo;
 	data.address = variable;
+	data.device = device;
 	data.expectedResponseCode = 0x8E;
-	prepareCommandReadInfo(data.requestData, data.id, data.command, variable);
-	addOrUpdateFifo(data);
+	prepareCommandReadInfo(data.requestData, data.device, data.id, data.command, variable);
+	data.completion = completion;
+	if (!addOrUpdateFifo(data))
+		return 0;
 	return data.id;
 }
 
-uint8_t VEBus::ReadInfo(Settings setting)
+uint8_t VEBus::ReadInfo(Settings setting, Completion completion, uint8_t device)
 {
 	Data data;
-	if (!getNextFreeId_1(data.id)) return 0;
 	data.responseExpected = true;
+	data.priority = RequestPriority::Background;
 	data.command = WinmonCommand::GetSettingInfo;
 	data.address = setting;
+	data.device = device;
 	data.expectedResponseCode = 0x89;
-	prepareCommandReadInfo(data.requestData, data.id, data.command, setting);
-	addOrUpdateFifo(data);
+	prepareCommandReadInfo(data.requestData, data.device, data.id, data.command, setting);
+	data.completion = completion;
+	if (!addOrUpdateFifo(data))
+		return 0;
 	return data.id;
 }
 
 void VEBus::SetSwitch(SwitchState state)
 {
+	// the switch frame is not acknowledged, it is repeated only after the keepalive time if unchanged
+	xSemaphoreTake(_semaphoreDataFifo, portMAX_DELAY);
+	uint32_t now = millis();
+	bool unchanged = _switchWrite.valid && _switchWrite.value == state && now - _switchWrite.timeMs < VEBUS_WRITE_KEEPALIVE_MS;
+	xSemaphoreGive(_semaphoreDataFifo);
+	if (unchanged)
+		return;
+
 	Data data;
 	data.responseExpected = false;
-	//data.command //add stwichCommandNr
+	data.priority = RequestPriority::Realtime;
+	data.command = SWITCH_STATE_FRAME;
+	data.address = 0;
 	prepareCommandSetSwitchState(data.requestData, state);
-	addOrUpdateFifo(data);
+	if (!addOrUpdateFifo(data))
+		return;
+	xSemaphoreTake(_semaphoreDataFifo, portMAX_DELAY);
+	_switchWrite = {true, uint16_t(state), now};
+	xSemaphoreGive(_semaphoreDataFifo);
+}
+
+void VEBus::BlockingCompletion::complete(const ResponseData &response, void *user)
+{
+	BlockingCompletion &wait = *static_cast<BlockingCompletion*>(user);
+	wait.response = response;
+	TaskHandle_t task = wait.task; // wait might be gone as soon as done is set
+	wait.done.store(true, std::memory_order_release);
+	xTaskNotifyGive(task);
+}
+
+VEBus::ResponseData VEBus::ReadBlocking(RamVariables variable, TickType_t timeout)
+{
+	BlockingCompletion wait{.task = xTaskGetCurrentTaskHandle()};
+	return waitBlocking(Read(variable, {BlockingCompletion::complete, &wait}), wait, timeout);
+}
+
+VEBus::ResponseData VEBus::ReadBlocking(Settings setting, TickType_t timeout)
+{
+	BlockingCompletion wait{.task = xTaskGetCurrentTaskHandle()};
+	return waitBlocking(Read(setting, {BlockingCompletion::complete, &wait}), wait, timeout);
+}
+
+VEBus::ResponseData VEBus::waitBlocking(uint8_t id, BlockingCompletion &wait, TickType_t timeout)
+{
+	if (id == 0)
+		return {.id = 0, .error = RequestError::FifoFull};
+	TickType_t start = xTaskGetTickCount();
+	while (!wait.done.load(std::memory_order_acquire)) {
+		TickType_t elapsed = xTaskGetTickCount() - start;
+		if (elapsed >= timeout)
+			break;
+		ulTaskNotifyTake(pdTRUE, timeout - elapsed);
+	}
+	if (!wait.done.load(std::memory_order_acquire) && Cancel(id))
+		return {.id = id, .error = RequestError::Cancelled};
+	// the request already left the fifo, its completion is called right away
+	while (!wait.done.load(std::memory_order_acquire))
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+	return wait.response;
+}
+
+bool VEBus::Cancel(uint8_t id)
+{
+	xSemaphoreTake(_semaphoreDataFifo, portMAX_DELAY);
+	Data *entry = findFifoEntry(id);
+	if (entry)
+		removeFifoEntry(entry - _dataFifo.begin());
+	xSemaphoreGive(_semaphoreDataFifo);
+	return entry != nullptr;
+}
+
+bool VEBus::Poll(RamVariables variable, uint32_t period_ms)
+{
+	return addPoll(WinmonCommand::ReadRAMVar, variable, period_ms);
+}
+
+bool VEBus::Poll(Settings setting, uint32_t period_ms)
+{
+	return addPoll(WinmonCommand::ReadSetting, setting, period_ms);
+}
+
+bool VEBus::addPoll(uint8_t command, uint8_t address, uint32_t period_ms)
+{
+	bool success = true;
+	xSemaphoreTake(_semaphoreDataFifo, portMAX_DELAY);
+	_pollEntries.remove_if([&](const PollEntry &e) { return e.command == command && e.address == address; });
+	if (period_ms)
+		success = _pollEntries.push(PollEntry{.command = command, .address = address, .periodMs = period_ms, .releaseMs = millis(), .missedDeadlines = 0});
+	xSemaphoreGive(_semaphoreDataFifo);
+	if (!success)
+		LogError("No free poll entry for command {} address {}", command, address);
+	return success;
+}
+
+// earliest deadline first selection of the due poll entries, due ram variables are packed
+// into a single request. Has to be called with _semaphoreDataFifo taken.
+// returns the request added to the fifo or nullptr if nothing is due
+VEBus::Data* VEBus::schedulePoll()
+{
+	uint32_t now = millis();
+	PollEntry *first{};
+	for (PollEntry &e: _pollEntries) {
+		if (int32_t(now - e.releaseMs) < 0)
+			continue;
+		if (!first || int32_t((e.releaseMs + e.periodMs) - (first->releaseMs + first->periodMs)) < 0)
+			first = &e;
+	}
+	if (!first || _dataFifo.full())
+		return nullptr;
+
+	Data data{};
+	data.responseExpected = true;
+	data.priority = RequestPriority::Telemetry;
+	data.command = first->command;
+	data.address = first->address;
+	// releases the entry and counts a missed deadline if it is already overdue
+	auto issue = [&](PollEntry &e) {
+		if (int32_t(now - (e.releaseMs + e.periodMs)) >= 0) {
+			++e.missedDeadlines;
+			++_pollMissedDeadlines;
+		}
+		e.releaseMs += e.periodMs;
+		if (int32_t(now - e.releaseMs) >= 0) // do not try to catch up on all missed periods
+			e.releaseMs = now + e.periodMs;
+	};
+	if (first->command == WinmonCommand::ReadRAMVar) {
+		data.expectedResponseCode = 0x85;
+		// pack further due ram variables, again by earliest deadline
+		while (first && data.addresses.push(first->address)) {
+			issue(*first);
+			first = {};
+			for (PollEntry &e: _pollEntries) {
+				if (e.command != WinmonCommand::ReadRAMVar || int32_t(now - e.releaseMs) < 0)
+					continue;
+				if (!first || int32_t((e.releaseMs + e.periodMs) - (first->releaseMs + first->periodMs)) < 0)
+					first = &e;
+			}
+		}
+		prepareCommandReadMultiRAMVar(data.requestData, data.device, data.id, data.addresses.begin(), data.addresses.size());
+	} else {
+		data.expectedResponseCode = 0x86;
+		issue(*first);
+		prepareCommandReadSetting(data.requestData, data.device, data.id, data.address);
+	}
+	data.sentTimeMs = now;
+	if (!pushFifoEntry(data))
+		return nullptr;
+	return _dataFifo.back();
 }
 
 const RAMVarInfo& VEBus::GetRamVarInfo(RamVariables variable)
@@ -289,173 +503,199 @@ const SettingInfo& VEBus::GetSettingInfo(Settings setting)
 
 bool VEBus::NewMasterMultiLedAvailable()
 {
-	return _masterMultiLedNewData;
+	return _masterMultiLedSnapshot.has_new();
 }
 
 MasterMultiLed VEBus::GetMasterMultiLed()
 {
-	MasterMultiLed multiLed;
-	xSemaphoreTake(_semaphoreStatus, VEBUS_MAX_SEM_DELAY);
-	_masterMultiLedNewData = false;
-	multiLed = _masterMultiLed;
-	xSemaphoreGive(_semaphoreStatus);
-
-	return multiLed;
+	return _masterMultiLedSnapshot.load();
 }
 
 bool VEBus::NewMultiPlusStatusAvailable()
 {
-	return _multiPlusStatusNewData;
+	return _multiPlusStatusSnapshot.has_new();
 }
 
 MultiPlusStatus VEBus::GetMultiPlusStatus()
 {
-	MultiPlusStatus multiStatus;
-	xSemaphoreTake(_semaphoreStatus, VEBUS_MAX_SEM_DELAY);
-	_multiPlusStatusNewData = false;
-	multiStatus = _multiPlusStatus;
-	xSemaphoreGive(_semaphoreStatus);
-
-	return multiStatus;
+	return _multiPlusStatusSnapshot.load();
 }
 
 bool VEBus::NewDcInfoAvailable()
 {
-	return _dcInfo.newInfo;
+	return _dcInfoSnapshot.has_new();
 }
 
 DcInfo VEBus::GetDcInfo()
 {
-	DcInfo info;
-	xSemaphoreTake(_semaphoreStatus, VEBUS_MAX_SEM_DELAY);
-	_dcInfo.newInfo = false;
-	info = _dcInfo;
-	xSemaphoreGive(_semaphoreStatus);
-	return info;
+	return _dcInfoSnapshot.load();
 }
 
 AcInfo VEBus::GetAcInfo(uint8_t type)
 {
-	AcInfo info;
-	xSemaphoreTake(_semaphoreStatus, VEBUS_MAX_SEM_DELAY);
-	info = _acInfo[PhaseToIdx(PhaseInfo(type))];
-	_acInfo[PhaseToIdx(PhaseInfo(type))].newInfo = false;
-	xSemaphoreGive(_semaphoreStatus);
-	return info;
+	uint8_t idx = PhaseToIdx(PhaseInfo(type));
+	if (idx >= _acInfoSnapshot.size())
+		return AcInfo{.Phase = PhaseInfo(type)};
+	return _acInfoSnapshot[idx].load();
 }
 
-uint8_t VEBus::NewAcInfoAvailable()
+AcInfo VEBus::GetDeviceAcInfo(uint8_t device)
 {
-	uint8_t phaseId = 0;
-	for (auto& element : _acInfo) {
-		if (element.newInfo == false) continue;
-		phaseId = element.Phase;
-		break;
+	if (device >= VEBUS_DEVICE_COUNT)
+		return AcInfo{};
+	return _acInfoSnapshot[PhaseToIdx(DeviceToPhase(device))].peek();
+}
+
+VEBus::ClusterInfo VEBus::GetClusterInfo()
+{
+	ClusterInfo cluster{};
+	for (uint8_t device = 0; device < VEBUS_DEVICE_COUNT; ++device) {
+		AcInfo ac = GetDeviceAcInfo(device);
+		if (ac.Phase != DeviceToPhase(device)) // no info frame received yet
+			continue;
+		cluster.Devices++;
+		cluster.MainPowerW += ac.MainVoltage * ac.MainCurrent;
+		cluster.InverterPowerW += ac.InverterVoltage * ac.InverterCurrent;
+		cluster.MinMainVoltage = cluster.Devices == 1 ? ac.MainVoltage: std::min(cluster.MinMainVoltage, ac.MainVoltage);
+		cluster.MaxMainVoltage = std::max(cluster.MaxMainVoltage, ac.MainVoltage);
 	}
+	cluster.Dc = _dcInfoSnapshot.peek();
+	return cluster;
+}
 
-	return phaseId;
+uint8_t VEBus::NewAcInfoAvailable()
+{
+	for (uint8_t i = 0; i < _acInfoSnapshot.size(); ++i) {
+		if (_acInfoSnapshot[i].has_new())
+			return PHASE_START + i;
+	}
+	return 0;
 }
 
-uint8_t VEBus::ReadSoftwareVersion()
+uint8_t VEBus::ReadSoftwareVersion(uint8_t device)
 {
 	Data data;
-	if (!getNextFreeId_1(data.id)) return 0;
 	data.responseExpected = true;
+	data.priority = RequestPriority::Background;
 	data.command = WinmonCommand::SendSoftwareVersionPart0;
 	data.address = 0;
+	data.device = device;
 	data.expectedResponseCode = 0x82;
-	prepareCommandReadSoftwareVersion(data.requestData, data.id, data.command);
-	addOrUpdateFifo(data);
+	prepareCommandReadSoftwareVersion(data.requestData, data.device, data.id, data.command);
+	if (!addOrUpdateFifo(data))
+		return 0;
 	return data.id;
 }
 
-uint8_t VEBus::CommandReadDeviceState()
+uint8_t VEBus::CommandReadDeviceState(uint8_t device)
 {
 	Data data;
-	if (!getNextFreeId_1(data.id)) return 0;
 	data.responseExpected = true;
+	data.priority = RequestPriority::Background;
 	data.command = WinmonCommand::GetSetDeviceState;
 	data.address = 0;
+	data.device = device;
 	data.expectedResponseCode = 0x94;
-	prepareCommandSetGetDeviceState(data.requestData, data.id, CommandDeviceState::Inquire);
-	addOrUpdateFifo(data);
+	prepareCommandSetGetDeviceState(data.requestData, data.device, data.id, CommandDeviceState::Inquire);
+	if (!addOrUpdateFifo(data))
+		return 0;
 	return data.id;
 }
 
-void VEBus::addOrUpdateFifo(const Data &data, bool updateIfExist)
+bool VEBus::addOrUpdateFifo(Data &data, bool updateIfExist)
 {
-	xSemaphoreTake(_semaphoreDataFifo, VEBUS_MAX_SEM_DELAY);
-	if (updateIfExist)
+	xSemaphoreTake(_semaphoreDataFifo, portMAX_DELAY);
+	if (updateIfExist && !data.completion.cb)
 	{
 		for (auto& element : _dataFifo) {
 
-			if (element.address == data.address && element.command == data.command)
-			{
-				element = data;
-				element.sentTimeMs = millis();
-				element.IsSent = false;
+			if (element.completion.cb || element.address != data.address || element.command != data.command || element.device != data.device)
+				continue;
+			// a packed read keeps the address of its first variable, it must not be replaced by a read of less variables
+			bool covered = std::all_of(data.addresses.begin(), data.addresses.end(), [&](uint8_t a) {
+				return std::find(element.addresses.begin(), element.addresses.end(), a) != element.addresses.end(); });
+			if (!covered)
+				continue;
+			if (element.addresses.size() > data.addresses.size()) {
+				data.id = element.id; // answered by the response of the larger read
 				xSemaphoreGive(_semaphoreDataFifo);
-				LogInfo("Updated data in fifo[{}]", _dataFifo.size());
-				return;
+				return true;
 			}
+			if (!assignFreeId(data))
+				break;
+			setFifoEntry(&element - _dataFifo.begin(), data);
+			element.sentTimeMs = millis();
+			element.IsSent = false;
+			xSemaphoreGive(_semaphoreDataFifo);
+			LogInfo("Updated data in fifo[{}]", _dataFifo.size());
+			return true;
 		}
 	}
 	
-	if (_dataFifo.push(data)) {
+	bool success = pushFifoEntry(data);
+	if (success) {
 		_dataFifo.back()->responseData.clear();
 		_dataFifo.back()->sentTimeMs = millis();
 		LogInfo("Added data to fifo[{}]", _dataFifo.size());
 	} else
 		LogError("Failed to add request");
 	xSemaphoreGive(_semaphoreDataFifo);
+	return success;
 }
 
-//possible ID_1 between 0x80 and 0xFF (0xE4-0xE7 used from Venus OS)
-//* return false if no ID free
-bool VEBus::getNextFreeId_1(uint8_t &id)
+// requests without a response are sent without an id
+bool VEBus::assignFreeId(Data &data)
 {
-	bool idUsed = false;
-	for (uint8_t i = 0; i < 127; i++)
-	{
-		++_id;
-		if (_id < 0x80) _id = 0x80;
+	if (!data.responseExpected)
+		return true;
+	if (!_requestIds.next_free(data.id))
+		return false;
+	data.requestData[1] = data.id; // the id follows the device byte in all winmon requests
+	return true;
+}
 
-		for (auto& element : _dataFifo) {
+bool VEBus::pushFifoEntry(Data &data)
+{
+	if (_dataFifo.full() || !assignFreeId(data) || !_dataFifo.push(data))
+		return false;
+	setFifoEntry(_dataFifo.back_idx(), data);
+	armResponseTimeout(millis() + VEBUS_RESPONSE_TIMEOUT);
+	return true;
+}
 
-			if (element.id == _id)
-			{
-				idUsed = true;
-				break;
-			}
-		}
+void VEBus::setFifoEntry(int idx, const Data &data)
+{
+	Data &entry = _dataFifo[idx];
+	_requestIds.release(entry.id);
+	entry = data;
+	_requestIds.set(entry.id, idx);
+	armResponseTimeout(millis() + VEBUS_RESPONSE_TIMEOUT);
+}
 
-		if (!idUsed)
-		{
-			id = _id;
-			return true;
-		}
+// swap-pop removal, the last entry is moved to idx
+void VEBus::removeFifoEntry(int idx)
+{
+	Data &entry = _dataFifo[idx];
+	_requestIds.release(entry.id);
+	if (idx != _dataFifo.back_idx()) {
+		entry = *_dataFifo.back();
+		_requestIds.set(entry.id, idx);
 	}
-
-	return false;
+	_dataFifo.pop();
 }
 
-void prepareCommand(VEBusBuffer &buffer, uint8_t frameNr)
+VEBus::Data* VEBus::findFifoEntry(uint8_t id)
 {
-	if (!buffer.resize(buffer.size() + 4)) {
-		LogError("Failed to allocate enough data for command prefix");
-		return;
-	}
-	for (int i = buffer.size() - 1; i >= 4; --i)
-		buffer[i] = buffer[i - 4];
-	buffer[0] = MK3_ID_0;
-	buffer[1] = MK3_ID_1;
-	buffer[2] = DATA_FRAME;
-	buffer[3] = NEXT_FRAME_NR(frameNr);
+	int idx = _requestIds.find(id);
+	if (idx < 0)
+		return nullptr;
+	Data &entry = _dataFifo[idx];
+	return entry.id == id ? &entry : nullptr;
 }
 
-void fill_command_buffer(VEBusBuffer &buffer, uint8_t id, uint8_t winmonCommand, StorageType storageType, uint8_t address, uint8_t lowByte, uint8_t highByte) {
+void fill_command_buffer(VEBusBuffer &buffer, uint8_t device, uint8_t id, uint8_t winmonCommand, StorageType storageType, uint8_t address, uint8_t lowByte, uint8_t highByte) {
 	buffer.clear();
-	buffer.push(0x00);
+	buffer.push(device);
 	buffer.push(id);
 	buffer.push(WinmonCommand::WriteViaID);
 	buffer.push(u8((winmonCommand == WinmonCommand::WriteRAMVar) ? VariableType::RamVar : VariableType::Setting) | u8(storageType)); // 0x02 -> no eeprom write
@@ -468,10 +708,10 @@ void fill_command_buffer(VEBusBuffer &buffer, uint8_t id, uint8_t winmonCommand,
 // Response: 0x85 / 0x90 < Lo(Value) > < Hi(Value)>  
 // 0x85 = RamReadOK. 
 // 0x90 = Variable not supported(in which case <Value> is not valid).
-uint8_t prepareCommandReadMultiRAMVar(VEBusBuffer &buffer, uint8_t id, uint8_t* addresses, uint8_t addressSize)
+uint8_t prepareCommandReadMultiRAMVar(VEBusBuffer &buffer, uint8_t device, uint8_t id, uint8_t* addresses, uint8_t addressSize)
 {
 	buffer.clear();
-	buffer.push(0x00);
+	buffer.push(device);
 	buffer.push(id);
 	buffer.push(WinmonCommand::ReadRAMVar);
 	for (uint8_t i = 0; i < addressSize; i++)
@@ -482,20 +722,20 @@ uint8_t prepareCommandReadMultiRAMVar(VEBusBuffer &buffer, uint8_t id, uint8_t*
 	return addressSize;
 }
 
-void prepareCommandReadSetting(VEBusBuffer &buffer, uint8_t id, uint16_t address)
+void prepareCommandReadSetting(VEBusBuffer &buffer, uint8_t device, uint8_t id, uint16_t address)
 {
 	buffer.clear();
-	buffer.push(0x00);
+	buffer.push(device);
 	buffer.push(id);
 	buffer.push(WinmonCommand::ReadSetting);
 	buffer.push(address & 0xFF);
 	buffer.push(address >> 8);
 }
 
-void prepareCommandReadInfo(VEBusBuffer& buffer, uint8_t id, uint8_t winmonCommand, uint16_t setting)
+void prepareCommandReadInfo(VEBusBuffer& buffer, uint8_t device, uint8_t id, uint8_t winmonCommand, uint16_t setting)
 {
 	buffer.clear();
-	buffer.push(0x00);
+	buffer.push(device);
 	buffer.push(id);
 	buffer.push(winmonCommand);
 	buffer.push(setting & 0xFF);
@@ -503,18 +743,18 @@ void prepareCommandReadInfo(VEBusBuffer& buffer, uint8_t id, uint8_t winmonComma
 }
 
 //long Winmon frames
-void prepareCommandReadSoftwareVersion(VEBusBuffer& buffer, uint8_t id, uint8_t winmonCommand)
+void prepareCommandReadSoftwareVersion(VEBusBuffer& buffer, uint8_t device, uint8_t id, uint8_t winmonCommand)
 {
 	buffer.clear();
-	buffer.push(0x00);
+	buffer.push(device);
 	buffer.push(id);
 	buffer.push(winmonCommand);
 }
 
-void prepareCommandSetGetDeviceState(VEBusBuffer& buffer, uint8_t id, CommandDeviceState command, uint8_t state)
+void prepareCommandSetGetDeviceState(VEBusBuffer& buffer, uint8_t device, uint8_t id, CommandDeviceState command, uint8_t state)
 {
 	buffer.clear();
-	buffer.push(0x00);
+	buffer.push(device);
 	buffer.push(id);
 	buffer.push(WinmonCommand::GetSetDeviceState);
 	buffer.push(command);
@@ -525,80 +765,13 @@ void prepareCommandSetGetDeviceState(VEBusBuffer& buffer, uint8_t id, CommandDev
 void prepareCommandSetSwitchState(VEBusBuffer& buffer, SwitchState switchState)
 {
 	buffer.clear();
-	buffer.push(0x3F);
+	buffer.push(SWITCH_STATE_FRAME);
 	buffer.push(switchState);
 	buffer.push(0x00);
 	buffer.push(0x00);
 	buffer.push(0x00);
 }
 
-void stuffingFAtoFF(VEBusBuffer& buffer)
-{
-	uint32_t fas{};
-	for (uint8_t v: buffer)
-		if (v >= 0xFA)
-			++fas;
-
-	if (!buffer.resize(buffer.size() + fas)) {
-		LogError("Failed to stuff FA to FF");
-		return;
-	}
-		
-	for (uint8_t *dst = buffer.back(), *src = dst - fas; src && src >= buffer.begin(); --src)
-	{
-		if (*src >= 0xFA)
-		{
-			*dst-- = 0x70 | (*src & 0x0F);
-			*dst-- = 0xFA;
-		} else
-			*dst-- = *src;
-	}
-}
-
-void VEBus::DestuffingFAtoFF(VEBusBuffer& buffer)
-{
-	if (buffer.size() <= 4)
-		return;
-
-	uint32_t fas{};
-	for (uint8_t *src = buffer.begin() + 4, *dst = src; src && src < buffer.end(); ++dst)
-	{
-		if (*src == 0xFA) {
-			if (src[1] == 0xFF) {
-				*dst++ = 0xFA;
-				*dst = 0xFF;
-			} else {
-				*dst = 0x80 + src[1];
-				++fas;
-			}
-			src += 2;
-		} else
-			*dst = *src++;
-	}
-	std::ignore = buffer.resize(buffer.size() - fas);
-}
-
-void appendChecksum(VEBusBuffer& buffer)
-{
-	//calculate checksum without MK3_ID
-	uint8_t cs = 1;
-	if (buffer.size() < 2) return;
-
-	for (int i = 2; i < buffer.size(); i++) cs -= buffer[i];
-
-	if (cs >= 0xFB)
-	{
-		buffer.push(0xFA);
-		buffer.push(cs - 0xFA);
-	}
-	else
-	{
-		buffer.push(cs);
-	}
-
-	buffer.push(END_OF_FRAME);  //End Of Frame
-}
-
 uint16_t convertRamVarToRawValue(RamVariables variable, float value, const RAMVarInfos &ramVarInfoList)
 {
 	uint16_t rawValue;
@@ -672,141 +845,148 @@ float convertSettingToValue(Settings setting, uint16_t rawValue, const SettingIn
 
 
 
+struct FrameHandler
+{
+	const VEBusFrameLayout::Frame *layout;
+	void (VEBus::*decode)(VEBusFrame);
+	ReceivedMessageType result;
+	VEBus::FrameStat stat;
+};
+// new frame types only need a layout in ve_bus_frame_layout.h and an entry here
+constexpr std::array FrameHandlers{
+	FrameHandler{&VEBusFrameLayout::Response::frame, &VEBus::decodeResponseFrame, ReceivedMessageType::Unknown, VEBus::ResponseFrames},
+	FrameHandler{&VEBusFrameLayout::InfoFrame::frame, &VEBus::decodeInfoFrame, ReceivedMessageType::Unknown, VEBus::InfoFrames},
+	FrameHandler{&VEBusFrameLayout::MasterMultiLed::frame, &VEBus::decodeMasterMultiLed, ReceivedMessageType::Known, VEBus::LedFrames},
+	FrameHandler{&VEBusFrameLayout::BatteryCondition::frame, &VEBus::decodeBatteryCondition, ReceivedMessageType::Known, VEBus::BatteryConditionFrames},
+	FrameHandler{&VEBusFrameLayout::ChargerInverterCondition::frame, &VEBus::decodeChargerInverterCondition, ReceivedMessageType::Known, VEBus::ChargerInverterFrames},
+	FrameHandler{&VEBusFrameLayout::AcPhaseInformation::frame, &VEBus::decodeAcPhaseInformation, ReceivedMessageType::AcPhaseInformation, VEBus::AcPhaseFrames},
+};
+constexpr std::array<uint8_t, 256> FrameDispatch = VEBusFrameLayout::make_dispatch(FrameHandlers);
+
 //Runs on core 0
-ReceivedMessageType VEBus::decodeVEbusFrame(VEBusBuffer& buffer)
+ReceivedMessageType VEBus::decodeVEbusFrame(VEBusFrame buffer)
 {
-	ReceivedMessageType result = ReceivedMessageType::Unknown;
+	++_stats.frames[UnknownFrames]; // corrected below if the frame is known
+	if (buffer.size() < 5) return ReceivedMessageType::Unknown;
 	if ((buffer[0] != MP_ID_0) || (buffer[1] != MP_ID_1)) return ReceivedMessageType::Unknown;
-	LogWarning("Retrieved data frame type: 0x{:02x}", int(buffer[4]));
-	if ((buffer[2] == SYNC_FRAME) && (buffer.size() == 10) && (buffer[4] == SYNC_BYTE)) return ReceivedMessageType::sync;
+	if ((buffer[2] == SYNC_FRAME) && (buffer.size() == 10) && (buffer[4] == SYNC_BYTE)) {
+		--_stats.frames[UnknownFrames];
+		++_stats.frames[SyncFrames];
+		return ReceivedMessageType::sync;
+	}
 	if (buffer[2] != DATA_FRAME) return ReceivedMessageType::Unknown;
 
-	switch (buffer[4]) {
-	case 0x00:
-	{
-		if (buffer.size() < 6) return ReceivedMessageType::Unknown;
-		xSemaphoreTake(_semaphoreDataFifo, VEBUS_MAX_SEM_DELAY);
-		for (uint8_t i = 0; i < _dataFifo.size(); i++)
-		{
-			LogWarning("Got a response for a message");
-			if (_dataFifo[i].id != buffer[5]) continue;
-			_dataFifo[i].responseData = buffer;
-			break;
-		}
-		xSemaphoreGive(_semaphoreDataFifo);
-		break;
-	}
-	case 0x20: //Info Frame
-	{
-		if (buffer.size() < 20) return ReceivedMessageType::Unknown;
-		decodeInfoFrame(buffer);
-		break;
-	}
-	case 0x41:
-	{
-		if ((buffer.size() == 19) && (buffer[5] == 0x10))
-		{
-			decodeMasterMultiLed(buffer);
-			result = ReceivedMessageType::Known;
-		}
-		break;
+	uint8_t handler_idx = FrameDispatch[buffer[4]];
+	if (handler_idx == VEBusFrameLayout::NO_FRAME) return ReceivedMessageType::Unknown;
+	const FrameHandler &handler = FrameHandlers[handler_idx];
+	if (!(*handler.layout)(buffer)) return ReceivedMessageType::Unknown;
+	--_stats.frames[UnknownFrames];
+	++_stats.frames[handler.stat];
+	(this->*handler.decode)(buffer);
+	return handler.result;
+}
+
+float VEBus::decodeField(const VEBusFrameLayout::Field &field, VEBusFrame buffer) const
+{
+	float value = field.value(buffer);
+	if (field.ram_var != VEBusFrameLayout::NO_RAM_VAR) {
+		int16_t scale = abs(_ramVarInfoList[field.ram_var].Scale);
+		if (scale >= 0x4000) scale = (0x8000 - scale);
+		value = value / (scale + 0.0f) + _ramVarInfoList[field.ram_var].Offset;
 	}
-	case 0x70:
-	{
-		if ((buffer.size() == 15) && (buffer[5] == 0x81) && (buffer[6] == 0x64) && (buffer[7] == 0x14) && (buffer[8] == 0xBC) && (buffer[9] == 0x02) && (buffer[12] == 0x00))
-		{
-			decodeBatteryCondition(buffer);
-			result = ReceivedMessageType::Known;
+	if (field.factor_offset != VEBusFrameLayout::NO_FACTOR)
+		value *= buffer[field.factor_offset];
+	return value;
+}
+
+void VEBus::decodeResponseFrame(VEBusFrame buffer)
+{
+	uint8_t id = VEBusFrameLayout::Response::Id.raw(buffer);
+	Data data{};
+	bool gotResponse{};
+	bool rejected{};
+	xSemaphoreTake(_semaphoreDataFifo, portMAX_DELAY);
+	if (Data *entry = findFifoEntry(id)) {
+		if (buffer.size() > 6 && buffer[6] == entry->expectedResponseCode) {
+			if (entry->responseData.resize(buffer.size()))
+				std::copy_n(buffer.begin(), buffer.size(), entry->responseData.begin());
+			data = *entry;
+			removeFifoEntry(entry - _dataFifo.begin());
+			gotResponse = true;
+		} else if (entry->resendCount >= VEBUS_MAX_RESEND) {
+			data = *entry;
+			removeFifoEntry(entry - _dataFifo.begin());
+			rejected = true;
+			LogError("resend count reached, removing data");
+		} else {
+			LogWarning("Failed to send, trying to resend");
+			++_stats.resends;
+			entry->resendCount++;
+			entry->IsSent = false;
+			entry->sentTimeMs = millis();
+			armResponseTimeout(entry->sentTimeMs + VEBUS_RESPONSE_TIMEOUT);
 		}
-		break;
-	}
-	case 0x80:
-	{
-		decodeChargerInverterCondition(buffer);
-		result = ReceivedMessageType::Known;
-		break;
-	}
-	case 0xE4:
-	{
-		if (buffer.size() != 21) break; 
-		result = ReceivedMessageType::AcPhaseInformation;
-		uint16_t ut = ((buffer[17] & 0x0F)<<8) + buffer[16];
-		xSemaphoreTake(_semaphoreStatus, VEBUS_MAX_SEM_DELAY);
-		_dcInfo.newInfo = true;
-		_dcInfo.Voltage = ut / 50.0;
-		xSemaphoreGive(_semaphoreStatus);
-		break;
-	}
 	}
+	xSemaphoreGive(_semaphoreDataFifo);
 
-	return result;
+	if (gotResponse)
+		saveResponseData(data);
+	if (rejected)
+		completeWithError(data, RequestError::Rejected);
 }
 
-void VEBus::decodeChargerInverterCondition(VEBusBuffer& buffer)
+void VEBus::decodeChargerInverterCondition(VEBusFrame buffer)
 {
-	if ((buffer.size() == 19) && (buffer[5] == 0x80) && ((buffer[6] & 0xFE) == 0x12) && (buffer[8] == 0x80) && ((buffer[11] & 0x10) == 0x10) && (buffer[12] == 0x00))
+	namespace Layout = VEBusFrameLayout::ChargerInverterCondition;
+	bool lowBattery = Layout::LowBattery(buffer);
+	if (_masterMultiLed.LowBattery != lowBattery)
 	{
-		if (_masterMultiLed.LowBattery != (buffer[7] == LOW_BATTERY))
-		{
-			xSemaphoreTake(_semaphoreStatus, VEBUS_MAX_SEM_DELAY);
-			_masterMultiLed.LowBattery = (buffer[7] == LOW_BATTERY);
-			_masterMultiLedNewData = true;
-			_masterMultiLedLogged = false;
-			xSemaphoreGive(_semaphoreStatus);
-
-		}
+		_masterMultiLed.LowBattery = lowBattery;
+		_masterMultiLedSnapshot.store(_masterMultiLed);
+	}
 
-		bool dcLevelAllowsInverting = (buffer[6] & 0x01);
-		float dcCurrentA = int16_t(((uint16_t)buffer[10] << 8) | buffer[9]) / 10.0f;
-		float temp = 0;
-		if ((buffer[11] & 0xF0) == 0x30) temp = buffer[15] / 10.0f;
+	bool dcLevelAllowsInverting = Layout::DcLevelAllowsInverting(buffer);
+	float dcCurrentA = Layout::DcCurrentA.value(buffer);
+	bool tempAvailable = Layout::TempAvailable(buffer);
+	float temp = tempAvailable ? Layout::Temp.value(buffer) : 0;
 
-		bool newValue = false;
-		newValue |= _multiPlusStatus.DcLevelAllowsInverting != dcLevelAllowsInverting;
-		newValue |= _multiPlusStatus.DcCurrentA != dcCurrentA;
-		if ((buffer[11] & 0xF0) == 0x30) newValue |= _multiPlusStatus.Temp != temp;
+	bool newValue = false;
+	newValue |= _multiPlusStatus.DcLevelAllowsInverting != dcLevelAllowsInverting;
+	newValue |= _multiPlusStatus.DcCurrentA != dcCurrentA;
+	if (tempAvailable) newValue |= _multiPlusStatus.Temp != temp;
 
-		if (newValue)
-		{
-			xSemaphoreTake(_semaphoreStatus, VEBUS_MAX_SEM_DELAY);
-			_multiPlusStatus.DcLevelAllowsInverting = dcLevelAllowsInverting;
-			_multiPlusStatus.DcCurrentA = dcCurrentA;
-			_multiPlusStatusNewData = true;
-			_multiPlusStatusLogged = false;
-			if ((buffer[11] & 0xF0) == 0x30) _multiPlusStatus.Temp = temp;
-			xSemaphoreGive(_semaphoreStatus);
-		}
+	if (newValue)
+	{
+		_multiPlusStatus.DcLevelAllowsInverting = dcLevelAllowsInverting;
+		_multiPlusStatus.DcCurrentA = dcCurrentA;
+		if (tempAvailable) _multiPlusStatus.Temp = temp;
+		_multiPlusStatusSnapshot.store(_multiPlusStatus);
 	}
 }
 
-void VEBus::decodeBatteryCondition(VEBusBuffer& buffer)
+void VEBus::decodeBatteryCondition(VEBusFrame buffer)
 {
-	if ((buffer.size() == 15) && (buffer[5] == 0x81) && (buffer[6] == 0x64) && (buffer[7] == 0x14) && (buffer[8] == 0xBC) && (buffer[9] == 0x02) && (buffer[12] == 0x00))
+	float multiplusAh = VEBusFrameLayout::BatteryCondition::BatterieAh.value(buffer);
+	if (multiplusAh != _multiPlusStatus.BatterieAh)
 	{
-		float multiplusAh = (((uint16_t)buffer[11] << 8) | buffer[10]);
-		if (multiplusAh != _multiPlusStatus.BatterieAh)
-		{
-			xSemaphoreTake(_semaphoreStatus, VEBUS_MAX_SEM_DELAY);
-			_multiPlusStatus.BatterieAh = multiplusAh;
-			_multiPlusStatusNewData = true;
-			_multiPlusStatusLogged = false;
-			xSemaphoreGive(_semaphoreStatus);
-		}
+		_multiPlusStatus.BatterieAh = multiplusAh;
+		_multiPlusStatusSnapshot.store(_multiPlusStatus);
 	}
 }
 
-void VEBus::decodeMasterMultiLed(VEBusBuffer& buffer)
+void VEBus::decodeMasterMultiLed(VEBusFrame buffer)
 {
+	namespace Layout = VEBusFrameLayout::MasterMultiLed;
 	LEDData lEDon{};
 	LEDData lEDblink{};
-	lEDon.value = buffer[6];
-	lEDblink.value = buffer[7];
-	bool lowBattery = (buffer[8] == LOW_BATTERY);
-	uint8_t lED_AcInputConfiguration = buffer[9];
-	float minimumInputCurrentLimit = (((uint16_t)buffer[11] << 8) | buffer[10]) / 10.0f;
-	float maximumInputCurrentLimit = (((uint16_t)buffer[13] << 8) | buffer[12]) / 10.0f;
-	float actualInputCurrentLimit = (((uint16_t)buffer[15] << 8) | buffer[14]) / 10.0f;
-	uint8_t switchRegister = buffer[16];
+	lEDon.value = Layout::LEDon.raw(buffer);
+	lEDblink.value = Layout::LEDblink.raw(buffer);
+	bool lowBattery = Layout::LowBattery(buffer);
+	uint8_t lED_AcInputConfiguration = Layout::AcInputConfiguration.raw(buffer);
+	float minimumInputCurrentLimit = Layout::MinimumInputCurrentLimitA.value(buffer);
+	float maximumInputCurrentLimit = Layout::MaximumInputCurrentLimitA.value(buffer);
+	float actualInputCurrentLimit = Layout::ActualInputCurrentLimitA.value(buffer);
+	uint8_t switchRegister = Layout::SwitchRegister.raw(buffer);
 
 	bool newValue = false;
 
@@ -821,7 +1001,6 @@ void VEBus::decodeMasterMultiLed(VEBusBuffer& buffer)
 
 	if (newValue)
 	{
-		xSemaphoreTake(_semaphoreStatus, VEBUS_MAX_SEM_DELAY);
 		_masterMultiLed.LEDon.value = lEDon.value;
 		_masterMultiLed.LEDblink.value = lEDblink.value;
 		_masterMultiLed.LowBattery = lowBattery;
@@ -830,19 +1009,14 @@ void VEBus::decodeMasterMultiLed(VEBusBuffer& buffer)
 		_masterMultiLed.MaximumInputCurrentLimitA = maximumInputCurrentLimit;
 		_masterMultiLed.ActualInputCurrentLimitA = actualInputCurrentLimit;
 		_masterMultiLed.SwitchRegister = switchRegister;
-		_masterMultiLedNewData = true;
-		_masterMultiLedLogged = false;
-		xSemaphoreGive(_semaphoreStatus);
+		_masterMultiLedSnapshot.store(_masterMultiLed);
 	}
 }
 
-void VEBus::decodeInfoFrame(VEBusBuffer &buffer)
+void VEBus::decodeInfoFrame(VEBusFrame buffer)
 {
-	if (buffer.size() < 18) {
-		LogError("decodeInfoFrame too small buffer");
-		return;
-	}
-	switch (buffer[9])
+	namespace Layout = VEBusFrameLayout::InfoFrame;
+	switch (Layout::Phase.raw(buffer))
 	{
 	case VEBusDefinition::L4:
 	case VEBusDefinition::L3:
@@ -853,51 +1027,62 @@ void VEBus::decodeInfoFrame(VEBusBuffer &buffer)
 	case VEBusDefinition::S_L4:
 	{
 		AcInfo info{};
-		info.Phase = (PhaseInfo)buffer[9];
-		info.State = (PhaseState)buffer[8];
-		info.MainVoltage = convertRamVarToValueSigned(RamVariables::UBat, (buffer[11] << 8 | buffer[10]), _ramVarInfoList);
-		info.MainCurrent = convertRamVarToValueSigned(RamVariables::IInverterRMS, (buffer[13] << 8 | buffer[12]), _ramVarInfoList) * buffer[5]; // buffer[5] -> BF factor
-		info.InverterVoltage = convertRamVarToValueSigned(RamVariables::UBat, (buffer[15] << 8 | buffer[14]), _ramVarInfoList);
-		info.InverterCurrent = convertRamVarToValueSigned(RamVariables::IInverterRMS, (buffer[17] << 8 | buffer[16]), _ramVarInfoList) * buffer[6]; // buffer[6] -> Inverter factor
+		info.Phase = (PhaseInfo)Layout::Phase.raw(buffer);
+		info.State = (PhaseState)Layout::State.raw(buffer);
+		info.MainVoltage = decodeField(Layout::MainVoltage, buffer);
+		info.MainCurrent = decodeField(Layout::MainCurrent, buffer);
+		info.InverterVoltage = decodeField(Layout::InverterVoltage, buffer);
+		info.InverterCurrent = decodeField(Layout::InverterCurrent, buffer);
 		//info.MainFrequency = convertSettingToValue(Settings::RepeatedAbsorptionTime,buffer[18]);
 
-		AcInfo &ac_entry = _acInfo[PhaseToIdx(info.Phase)];
-		if (info == ac_entry)
+		if (uint8_t device = PhaseToDevice(info.Phase); device < VEBUS_DEVICE_COUNT)
+			_energy.add_ac(device, time_us_64(), info.MainVoltage * info.MainCurrent, info.InverterVoltage * info.InverterCurrent);
+
+		uint8_t idx = PhaseToIdx(info.Phase);
+		if (info == _acInfo[idx])
 			return;
-		ac_entry.newInfo = true;
-		xSemaphoreTake(_semaphoreStatus, VEBUS_MAX_SEM_DELAY);
-		ac_entry = info;
-		xSemaphoreGive(_semaphoreStatus);
+		info.newInfo = true;
+		_acInfo[idx] = info;
+		_acInfoSnapshot[idx].store(info);
 		break;
 	}
 	case VEBusDefinition::DC: // 83 83 FE 72 20 40 A5 C4 01 0C 33 05 12 00 00 00 00 00 86 EB FF
 	{
 		DcInfo info{};
-		info.Voltage = convertRamVarToValueSigned(RamVariables::UBat, (buffer[11] << 8 | buffer[10]), _ramVarInfoList);
-		info.CurrentInverting = convertRamVarToValueSigned(RamVariables::IBat, (buffer[12] | (buffer[13] << 8) | (buffer[14] << 16)), _ramVarInfoList);
-		info.CurrentCharging = convertRamVarToValueSigned(RamVariables::IBat, (buffer[15] | (buffer[16] << 8) | (buffer[17] << 16)), _ramVarInfoList);
+		info.Voltage = decodeField(Layout::DcVoltage, buffer);
+		info.CurrentInverting = decodeField(Layout::DcCurrentInverting, buffer);
+		info.CurrentCharging = decodeField(Layout::DcCurrentCharging, buffer);
 		//info.InverterFrequency = 1 / convertSettingToValue(Settings::RepeatedAbsorptionTime, buffer[18]) * 10;
+		_energy.add_dc(time_us_64(), info.Voltage, info.CurrentCharging - info.CurrentInverting);
 
 		if (info == _dcInfo) break;
 		info.newInfo = true;
-		xSemaphoreTake(_semaphoreStatus, VEBUS_MAX_SEM_DELAY);
 		_dcInfo = info;
-		xSemaphoreGive(_semaphoreStatus);
+		_dcInfoSnapshot.store(info);
+		if (_dcInfoCallback.cb)
+			_dcInfoCallback.cb(info, _dcInfoCallback.user);
 		break;
 	}
 	default:
 		break;
 	}
-	xSemaphoreTake(_semaphoreStatus, VEBUS_MAX_SEM_DELAY);
+}
 
-	xSemaphoreGive(_semaphoreStatus);
+void VEBus::decodeAcPhaseInformation(VEBusFrame buffer)
+{
+	_dcInfo.newInfo = true;
+	_dcInfo.Voltage = VEBusFrameLayout::AcPhaseInformation::DcVoltage.value(buffer);
+	_dcInfoSnapshot.store(_dcInfo);
 }
 
 //Runs on core 0
 bool VEBus::commandHandling()
 {
-	if (!_communitationIsRunning) 
-		return true;
+	if (!_communitationIsRunning) {
+		serial.rx_consume(serial.rx_available());
+		_receiver.state = decltype(_receiver)::State::Hunt;
+		return false;
+	}
 
 	if (_communitationIsResumed)
 	{
@@ -905,111 +1090,114 @@ bool VEBus::commandHandling()
 		serial.tx_flush();
 	}
 
-	if (!serial.rx_available()) 
+	VEBusFrame frame = receiveFrame();
+	if (frame.empty())
 		return false;
-
-	while(serial.rx_available()) {
-		char c = serial.getc();
-		if (_receiveBuffer.full())
-			_receiveBuffer.clear();
-		_receiveBuffer.push(c);
-		if (c == END_OF_FRAME)
-			break;
-	}
-	if (*_receiveBuffer.back() != END_OF_FRAME) 
-		return false;
-
-	xSemaphoreTake(_semaphoreReceiveData, VEBUS_MAX_SEM_DELAY);
-	_receiveBufferList.push(_receiveBuffer);
-	xSemaphoreGive(_semaphoreReceiveData);
-
-	DestuffingFAtoFF(_receiveBuffer);
-	auto messageType = decodeVEbusFrame(_receiveBuffer);
-	uint8_t frameNr = _receiveBuffer[3];
-	_receiveBuffer.clear();
+	if (receive_cb)
+		receive_cb(frame);
+	auto messageType = decodeVEbusFrame(frame);
+	uint8_t frameNr = frame[3];
 
 	// check for sync frame and frames are waiting to be sent
-	if (messageType != ReceivedMessageType::sync || _dataFifo.empty())
+	if (messageType != ReceivedMessageType::sync || (_dataFifo.empty() && _pollEntries.empty()))
 		return true;
 
-	// we can now transmit a request that was not yet sent
-	xSemaphoreTake(_semaphoreDataFifo, VEBUS_MAX_SEM_DELAY);
+	// we can now transmit the highest priority (oldest within a priority) request that was not yet sent,
+	// if there is none a due poll request is sent
+	uint32_t syncUs = frame_notified_us;
+	xSemaphoreTake(_semaphoreDataFifo, portMAX_DELAY);
+	_stats.queueHighWater = std::max<uint32_t>(_stats.queueHighWater, _dataFifo.size());
 	Data* data{};
 	for (Data &d: _dataFifo) {
-		if (!d.IsSent) {
+		if (d.IsSent)
+			continue;
+		if (!data || d.priority < data->priority || (d.priority == data->priority && int32_t(d.sentTimeMs - data->sentTimeMs) < 0))
 			data = &d;
-			break;
-		}
 	}
+	if (!data)
+		data = schedulePoll();
 
-	if (data)
+	if (data) {
 		sendData(*data, frameNr);
+		uint32_t latencyUs = time_us_32() - syncUs;
+		++_stats.sends;
+		_stats.syncToSendSumUs += latencyUs;
+		_stats.syncToSendMaxUs = std::max(_stats.syncToSendMaxUs, latencyUs);
+		if (latencyUs > VEBUS_SYNC_SEND_WINDOW_US)
+			++_stats.missedSyncs;
+	}
+
+	// the same write to the other devices of the cluster is sent in the same sync slot
+	if (data && data->priority == RequestPriority::Realtime && VEBUS_DEVICE_COUNT > 1) {
+		for (Data &d: _dataFifo) {
+			if (d.IsSent || d.priority != RequestPriority::Realtime || d.command != data->command || d.address != data->address || d.device == data->device)
+				continue;
+			frameNr = NEXT_FRAME_NR(frameNr);
+			sendData(d, frameNr);
+		}
+	}
 
 	if (data && !data->responseExpected)
-		*data = *_dataFifo.pop();
+		removeFifoEntry(data - _dataFifo.begin());
 
 	xSemaphoreGive(_semaphoreDataFifo);
 	return true;
 }
 
+VEBusFrame VEBus::receiveFrame()
+{
+	using Receiver = decltype(_receiver);
+	for (std::span<uint8_t> bytes = serial.rx_contiguous(); !bytes.empty(); bytes = serial.rx_contiguous()) {
+		uint32_t used = 0;
+		Receiver::Result result = Receiver::Pending;
+		while (used < bytes.size() && result == Receiver::Pending)
+			result = _receiver.push(bytes[used++]);
+		serial.rx_consume(used);
+		_stats.rxBytes += used;
+		_statsWindowBytes += used;
+		switch (result) {
+		case Receiver::Complete: return _receiver.frame();
+		case Receiver::ChecksumError: ++_stats.checksumErrors; break;
+		case Receiver::EscapeError: ++_stats.escapeErrors; break;
+		case Receiver::Overflow: ++_stats.droppedFrames; break;
+		case Receiver::TooShort: ++_stats.shortFrames; break;
+		case Receiver::Pending: break;
+		}
+	}
+	return {};
+}
+
 void VEBus::sendData(VEBus::Data& data, uint8_t frameNr)
 {
-	VEBusBuffer sendData = data.requestData;
-	prepareCommand(sendData, frameNr);
-	stuffingFAtoFF(sendData);
-	appendChecksum(sendData);
+	uint32_t frameSize = VEBusFrameEncoder::encode(data.requestData, frameNr, _sendArena);
+	if (frameSize == 0)
+		LogError("Request of {} bytes does not fit into the send buffer", data.requestData.size());
 
 	serial.enable_send();
-	serial.write(sendData.begin(), sendData.size());
+	serial.write(_sendArena.data(), frameSize);
 	serial.tx_flush();
 	serial.enable_receive();
+	_stats.txBytes += frameSize;
+	_statsWindowBytes += frameSize;
+
+	uint32_t now = millis();
+	// sentTimeMs of a resend is the time of its timeout, only the first transmission waited in the queue
+	if (data.resendCount == 0) {
+		uint32_t waitMs = now - data.sentTimeMs;
+		auto bucket = std::lower_bound(QUEUE_WAIT_BUCKETS_MS.begin(), QUEUE_WAIT_BUCKETS_MS.end(), waitMs);
+		++_queueWaitHistogram[data.priority][bucket - QUEUE_WAIT_BUCKETS_MS.begin()];
+	}
 
-	data.sentTimeMs = millis();
+	data.sentTimeMs = now;
+	armResponseTimeout(now + VEBUS_RESPONSE_TIMEOUT);
 	data.IsSent = true;
 	data.IsLogged = false;
 }
 
-void VEBus::checkResponseMessage()
-{
-	Data data{};
-	bool got_response{};
-	xSemaphoreTake(_semaphoreDataFifo, VEBUS_MAX_SEM_DELAY);
-	for (int i = _dataFifo.back_idx(); i >= 0; --i)
-	{
-		if (_dataFifo[i].responseData.size() == 0)
-			continue;
-
-		if (_dataFifo[i].responseData[6] == _dataFifo[i].expectedResponseCode)
-		{
-			data = _dataFifo[i];
-			_dataFifo[i] = *_dataFifo.pop();
-			got_response = true;
-			LogInfo("Got expeted response");
-			break;
-		}
-
-		if (_dataFifo[i].resendCount >= VEBUS_MAX_RESEND) {
-			_dataFifo[i] = *_dataFifo.pop();
-			LogError("resend count reached, removing data");
-			break;
-		}
-		else {
-			LogWarning("Failed to send, trying to resend");
-			_dataFifo[i].resendCount++;
-			_dataFifo[i].IsSent = false;
-			_dataFifo[i].sentTimeMs = millis();
-			break;
-		}
-	}
-	xSemaphoreGive(_semaphoreDataFifo);
-
-	if (got_response) 
-		saveResponseData(data);
-}
-
 void VEBus::saveResponseData(const Data &data)
 {
 	bool callResponseCb = false;
+	bool completed = false;
 	ResponseData responseData;
 	responseData.id = data.id;
 	responseData.command = data.command;
@@ -1021,6 +1209,7 @@ void VEBus::saveResponseData(const Data &data)
 	{
 		if (data.responseData.size() != 19) {
 			LogWarning("SendSoftwareVersionPart0 wrong size {}", data.responseData.size());
+			responseData.error = RequestError::ConvertError;
 			break;
 		}
 		callResponseCb = true;
@@ -1034,6 +1223,7 @@ void VEBus::saveResponseData(const Data &data)
 	case VEBusDefinition::GetSetDeviceState:
 		if (data.responseData.size() != 11) {
 			LogWarning("GetSetDeviceState wrong size {}", data.responseData.size());
+			responseData.error = RequestError::ConvertError;
 			break;
 		}
 		callResponseCb = true;
@@ -1042,40 +1232,29 @@ void VEBus::saveResponseData(const Data &data)
 		break;
 	case VEBusDefinition::ReadRAMVar:
 	{
-		if (data.responseData.size() != 11) {
+		// response: 0x85 <lo1> <hi1> ... <loN> <hiN>, one callback per variable
+		int varCount = std::max(data.addresses.size(), 1);
+		if (data.responseData.size() != 9 + 2 * varCount) {
 			LogWarning("ReadRAMVar wrong size {}", data.responseData.size());
+			responseData.error = RequestError::ConvertError;
 			break;
 		}
-		callResponseCb = true;
-		uint16_t UnsignedRawValue = (((uint16_t)data.responseData[8] << 8) | data.responseData[7]);
-		int16_t signedRawValueint = ((int16_t)data.responseData[8] << 8) | data.responseData[7];
-		if (!_ramVarInfoList[data.address].available) break;
-		switch (_ramVarInfoList[data.address].dataType)
-		{
-		case VEBusDefinition::none:
-			break;
-		case VEBusDefinition::floatingPoint:
-			if (_ramVarInfoList[data.address].Scale < 0) responseData.value = float(convertRamVarToValueSigned((RamVariables)data.address, signedRawValueint, _ramVarInfoList));
-			else responseData.value = f32(convertRamVarToValue((RamVariables)data.address, UnsignedRawValue, _ramVarInfoList));
-
-			std::get<f32>(responseData.value) += _ramVarInfoList[data.address].Offset;
-			break;
-		case VEBusDefinition::unsignedInteger:
-			responseData.value = u32(UnsignedRawValue);
-			break;
-		case VEBusDefinition::signedInteger:
-			responseData.value = i32(signedRawValueint);
-			break;
-		default:
-			break;
+		for (int i = 0; i < varCount; ++i) {
+			responseData.address = data.addresses.empty() ? data.address : data.addresses[i];
+			saveRamVarValue(responseData, data.responseData[7 + 2 * i], data.responseData[8 + 2 * i]);
+			if (data.completion.cb)
+				data.completion.cb(responseData, data.completion.user);
+			else if (response_cb)
+				response_cb(responseData);
 		}
-		
+		completed = true;
 		break;
 	}
 	case VEBusDefinition::ReadSetting:
 	{
 		if (data.responseData.size() != 11) {
 			LogWarning("ReadSetting wrong size {}", data.responseData.size());
+			responseData.error = RequestError::ConvertError;
 			break;
 		}
 		callResponseCb = true;
@@ -1099,6 +1278,11 @@ void VEBus::saveResponseData(const Data &data)
 		break;
 	}
 	case VEBusDefinition::WriteRAMVar:
+		if (data.address == SET_POWER_ADDRESS && data.device < VEBUS_DEVICE_COUNT && data.requestData.size() >= 7) {
+			xSemaphoreTake(_semaphoreDataFifo, portMAX_DELAY);
+			_powerWrite[data.device] = {true, uint16_t(data.requestData[5] | (data.requestData[6] << 8)), millis()};
+			xSemaphoreGive(_semaphoreDataFifo);
+		}
 		break;
 	case VEBusDefinition::WriteSetting:
 		break;
@@ -1107,6 +1291,7 @@ void VEBus::saveResponseData(const Data &data)
 	case VEBusDefinition::GetSettingInfo:
 		if (data.responseData.size() != 20) {
 			LogWarning("GetSettingInfo wrong size {}", data.responseData.size());
+			responseData.error = RequestError::ConvertError;
 			break;
 		}
 		saveSettingInfoData(data);
@@ -1114,6 +1299,7 @@ void VEBus::saveResponseData(const Data &data)
 	case VEBusDefinition::GetRAMVarInfo:
 		if (data.responseData.size() != 13) {
 			LogWarning("GetRAMVarInfo wrong size {}", data.responseData.size());
+			responseData.error = RequestError::ConvertError;
 			break;
 		}
 		saveRamVarInfoData(data);
@@ -1126,12 +1312,48 @@ void VEBus::saveResponseData(const Data &data)
 		break;
 	}
 
-	if (callResponseCb && response_cb)
+	if (!completed && data.completion.cb)
+		data.completion.cb(responseData, data.completion.user);
+	else if (!completed && callResponseCb && response_cb)
 		response_cb(responseData);
 
 	LogInfo("Res: {}", data.responseData);
 }
 
+// converts the raw value of the ram variable responseData.address into responseData.value
+void VEBus::saveRamVarValue(ResponseData &responseData, uint8_t lowByte, uint8_t highByte)
+{
+	responseData.value = u32{};
+	uint16_t UnsignedRawValue = (((uint16_t)highByte << 8) | lowByte);
+	int16_t signedRawValueint = ((int16_t)highByte << 8) | lowByte;
+	if (responseData.address >= _ramVarInfoList.size() || !_ramVarInfoList[responseData.address].available) return;
+	switch (_ramVarInfoList[responseData.address].dataType)
+	{
+	case VEBusDefinition::none:
+		break;
+	case VEBusDefinition::floatingPoint:
+		if (_ramVarInfoList[responseData.address].Scale < 0) responseData.value = float(convertRamVarToValueSigned((RamVariables)responseData.address, signedRawValueint, _ramVarInfoList));
+		else responseData.value = f32(convertRamVarToValue((RamVariables)responseData.address, UnsignedRawValue, _ramVarInfoList));
+
+		std::get<f32>(responseData.value) += _ramVarInfoList[responseData.address].Offset;
+		break;
+	case VEBusDefinition::unsignedInteger:
+		responseData.value = u32(UnsignedRawValue);
+		break;
+	case VEBusDefinition::signedInteger:
+		responseData.value = i32(signedRawValueint);
+		break;
+	default:
+		break;
+	}
+}
+
+void VEBus::completeWithError(const Data &data, RequestError error)
+{
+	if (data.completion.cb)
+		data.completion.cb(ResponseData{.id = data.id, .command = data.command, .address = data.address, .error = error}, data.completion.user);
+}
+
 void VEBus::saveSettingInfoData(const Data& data)
 {
 	SettingInfo settingInfo;
@@ -1156,31 +1378,80 @@ void VEBus::saveRamVarInfoData(const Data& data)
 	LogInfo("RamVarInfo {}, sc: {}, offset: {}", data.address, ramVarInfo.Scale, ramVarInfo.Offset);
 }
 
-void VEBus::checkResponseTimeout()
+// has to be called with _semaphoreDataFifo taken
+void VEBus::armResponseTimeout(uint32_t deadlineMs)
 {
+	if (_timeoutArmed.load(std::memory_order_relaxed) && int32_t(deadlineMs - _nextTimeoutMs.load(std::memory_order_relaxed)) >= 0)
+		return;
+	_nextTimeoutMs.store(deadlineMs, std::memory_order_relaxed);
+	_timeoutArmed.store(true, std::memory_order_release);
+}
 
-	xSemaphoreTake(_semaphoreDataFifo, VEBUS_MAX_SEM_DELAY);
-	if (_dataFifo.empty()) {
-		xSemaphoreGive(_semaphoreDataFifo);
+TickType_t VEBus::ticksUntilResponseTimeout() const
+{
+	if (!_timeoutArmed.load(std::memory_order_acquire))
+		return pdMS_TO_TICKS(VEBUS_RESPONSE_TIMEOUT); // entries added by other tasks are armed at least this far in the future
+	int32_t remainingMs = _nextTimeoutMs.load(std::memory_order_relaxed) - millis();
+	return pdMS_TO_TICKS(std::max(remainingMs, int32_t(0)));
+}
+
+void VEBus::checkResponseTimeout()
+{
+	if (!_timeoutArmed.load(std::memory_order_acquire) || int32_t(millis() - _nextTimeoutMs.load(std::memory_order_relaxed)) < 0)
 		return;
-	}
 
+	// completions of removed requests are called after the fifo is released
+	static_vector<std::pair<Completion, ResponseData>, VEBUS_FIFO_SIZE> timedOut;
+	xSemaphoreTake(_semaphoreDataFifo, portMAX_DELAY);
+	uint32_t now = millis();
+	_timeoutArmed.store(false, std::memory_order_relaxed);
 	for (int i = _dataFifo.back_idx(); i >= 0; --i)
 	{
 		Data &d = _dataFifo[i];
-		if (millis() - d.sentTimeMs < VEBUS_RESPONSE_TIMEOUT)
+		if (now - d.sentTimeMs < VEBUS_RESPONSE_TIMEOUT) {
+			armResponseTimeout(d.sentTimeMs + VEBUS_RESPONSE_TIMEOUT);
 			continue;
+		}
 		LogWarning("Timeout id: {} command {} resend count: {}", d.id, d.command, d.resendCount);
+		++_stats.timeouts;
 		if (d.resendCount >= VEBUS_MAX_RESEND) {
-			std::swap(d, *_dataFifo.pop());
+			if (d.completion.cb)
+				timedOut.push({d.completion, ResponseData{.id = d.id, .command = d.command, .address = d.address, .error = RequestError::Timeout}});
+			removeFifoEntry(i);
 			LogWarning("The message is deleted.");
 		}
 		else {
+			++_stats.resends;
 			d.resendCount++;
 			d.IsSent = false;
-			d.sentTimeMs = millis();
+			d.sentTimeMs = now;
+			armResponseTimeout(now + VEBUS_RESPONSE_TIMEOUT);
 		}
 	}
 	xSemaphoreGive(_semaphoreDataFifo);
+
+	for (auto &[completion, response]: timedOut)
+		completion.cb(response, completion.user);
 }
 
+void VEBus::countWakeup(uint32_t latencyUs)
+{
+	++_stats.wakeups;
+	_stats.wakeLatencySumUs += latencyUs;
+	_stats.wakeLatencyMaxUs = std::max(_stats.wakeLatencyMaxUs, latencyUs);
+}
+
+void VEBus::publishStats()
+{
+	uint32_t now = millis();
+	uint32_t elapsedMs = now - _statsWindowMs;
+	if (elapsedMs < 1000)
+		return;
+	// 10 bit per byte on the wire (start, 8 data, stop)
+	_stats.busLoadPermille = uint64_t(_statsWindowBytes) * 10 * 1000 * 1000 / (uint64_t(serial.info.baudrate) * elapsedMs);
+	_stats.rxOverruns = serial.rx_overruns;
+	_statsWindowMs = now;
+	_statsWindowBytes = 0;
+	_statsSnapshot.store(_stats);
+	_energy.publish();
+}
@@ -0,0 +1,151 @@
+// Round trip and benchmark of the compressed history blocks: synthetic battery data (load steps and noise)
+// is aggregated into 1 s, 1 min and 15 min min/max/mean samples like time_series does, encoded into
+// history_blocks and decoded again with history_block_reader.
+
+#include "history_block.h"
+#include "test_util.h"
+
+#include <random>
+#include <span>
+#include <vector>
+
+// min/max/mean of the raw readings of one bucket
+static history_sample aggregate(std::span<const history_sample> raw) {
+	history_sample s{};
+	std::array<int32_t, HISTORY_CHANNELS> sum{};
+	int count{};
+	for (const history_sample &r: raw) {
+		if (!r.valid())
+			continue;
+		for (int c = 0; c < HISTORY_CHANNELS; ++c) {
+			sum[c] += r.mean[c];
+			s.min[c] = count ? std::min(s.min[c], r.min[c]): r.min[c];
+			s.max[c] = count ? std::max(s.max[c], r.max[c]): r.max[c];
+		}
+		++count;
+	}
+	if (!count)
+		return history_sample{};
+	for (int c = 0; c < HISTORY_CHANNELS; ++c)
+		s.mean[c] = int16_t(std::lround(double(sum[c]) / count));
+	return s;
+}
+
+// 5 readings per second of a 48 V battery with load steps, the bus is down for a minute now and then
+static std::vector<history_sample> battery_readings(uint32_t seconds) {
+	std::mt19937 rng{18};
+	std::normal_distribution<float> noise(0, 1);
+	std::uniform_int_distribution<int> step_s(30, 600);
+	std::uniform_real_distribution<float> load(-60, 60);
+	std::vector<history_sample> raw;
+	float current{}, soc_v{52.f};
+	uint32_t next_step{}, outage_until{};
+	for (uint32_t t = 0; t < seconds; ++t) {
+		if (t >= next_step) {
+			next_step = t + step_s(rng);
+			current = load(rng);
+		}
+		if (rng() % 20000 == 0)
+			outage_until = t + 60;
+		soc_v = std::clamp(soc_v + current * 2e-6f, 48.f, 56.f);
+		for (int i = 0; i < 5; ++i) {
+			history_sample s{};
+			if (t < outage_until) {
+				raw.push_back(s);
+				continue;
+			}
+			float a = current + .3f * noise(rng);
+			float v = soc_v + a * .01f + .01f * noise(rng);
+			std::array<float, HISTORY_CHANNELS> values{v, a, -a * v * 1.08f + 20 * noise(rng)};
+			for (int c = 0; c < HISTORY_CHANNELS; ++c)
+				s.min[c] = s.max[c] = s.mean[c] = history_sample::to_fixed(values[c], history_channel(c));
+			raw.push_back(s);
+		}
+	}
+	return raw;
+}
+
+static std::vector<history_sample> buckets(std::span<const history_sample> raw, size_t per_bucket) {
+	std::vector<history_sample> r;
+	for (size_t i = 0; i + per_bucket <= raw.size(); i += per_bucket)
+		r.push_back(aggregate(raw.subspan(i, per_bucket)));
+	return r;
+}
+
+static std::vector<history_block> encode(std::span<const history_sample> samples) {
+	std::vector<history_block> blocks;
+	history_prediction p{};
+	for (const history_sample &s: samples) {
+		if (!blocks.empty() && blocks.back().push(s, p))
+			continue;
+		blocks.push_back(history_block{});
+		p = {};
+		blocks.back().push(s, p);
+	}
+	return blocks;
+}
+
+static bool same(const history_sample &a, const history_sample &b) {
+	if (a.valid() != b.valid())
+		return false;
+	return !a.valid() || (a.min == b.min && a.max == b.max && a.mean == b.mean);
+}
+
+static void run(const char *name, std::span<const history_sample> samples) {
+	std::vector<history_block> blocks = encode(samples);
+
+	size_t idx{}, mismatches{};
+	for (const history_block &b: blocks)
+		for (history_block_reader r{b}; !r.done(); ++idx)
+			mismatches += idx >= samples.size() || !same(r.next(), samples[idx]);
+	CHECK_EQ(idx, samples.size());
+	CHECK_EQ(mismatches, 0u);
+
+	constexpr int REPEAT = 20;
+	double encode_ns = ns_per_call(REPEAT, [&](uint64_t) { do_not_optimize(encode(samples)); }) / samples.size();
+	double decode_ns = ns_per_call(REPEAT, [&](uint64_t) {
+		for (const history_block &b: blocks)
+			for (history_block_reader r{b}; !r.done();)
+				do_not_optimize(r.next());
+	}) / samples.size();
+
+	double bytes_per_sample = double(blocks.size() * history_block::SIZE) / samples.size();
+	constexpr double FLOAT_BYTES = 3 * HISTORY_CHANNELS * sizeof(float); // min/max/mean floats per channel
+	std::printf("%-6s %7zu samples in %5zu blocks: %5.2f bytes/sample, %4.1fx vs floats, %4.1fx vs history_sample, "
+		"encode %5.1f ns/sample, decode %5.1f ns/sample\n", name, samples.size(), blocks.size(), bytes_per_sample,
+		FLOAT_BYTES / bytes_per_sample, sizeof(history_sample) / bytes_per_sample, encode_ns, decode_ns);
+}
+
+static void test_extremes() {
+	// full int16 range jumps use the 16 bit code, nothing may be lost on wrap around
+	std::vector<history_sample> samples;
+	for (int i = 0; i < 200; ++i) {
+		history_sample s{};
+		int16_t v = i % 2 ? std::numeric_limits<int16_t>::max(): history_sample::INVALID + 1;
+		for (int c = 0; c < HISTORY_CHANNELS; ++c)
+			s.min[c] = s.max[c] = s.mean[c] = v;
+		s.max[1] = std::numeric_limits<int16_t>::max();
+		samples.push_back(i % 7 == 3 ? history_sample{}: s);
+	}
+	std::vector<history_block> blocks = encode(samples);
+	size_t idx{};
+	for (const history_block &b: blocks) {
+		CHECK(b.bits <= history_block::CAPACITY_BITS);
+		for (history_block_reader r{b}; !r.done(); ++idx)
+			CHECK(same(r.next(), samples[idx]));
+	}
+	CHECK_EQ(idx, samples.size());
+}
+
+int main() {
+	test_extremes();
+	std::vector<history_sample> raw = battery_readings(14 * 24 * 3600);
+	std::vector<history_sample> seconds = buckets(raw, 5);
+	run("1 s", std::span{seconds}.first(24 * 3600));
+	run("1 min", buckets(raw, 5 * 60));
+	run("15 min", buckets(raw, 5 * 900));
+	// the finest tier holds most of the samples, it has to reach 5x the history of float samples
+	std::vector<history_block> blocks = encode(std::span{seconds}.first(24 * 3600));
+	CHECK(3 * HISTORY_CHANNELS * sizeof(float) * 24 * 3600 >= 5 * blocks.size() * history_block::SIZE);
+	return test_result();
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Host replacement of the FreeRTOS headers, tasks are std::threads, a tick is a millisecond
+#include <cstdint>
+
+using TickType_t = uint32_t;
+using BaseType_t = long;
+using UBaseType_t = unsigned long;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define portMAX_DELAY TickType_t(0xffffffff)
+#define pdMS_TO_TICKS(ms) TickType_t(ms)
+#define portYIELD_FROM_ISR(woken) (void)(woken)
@@ -0,0 +1,15 @@
+#pragma once
+
+// Host replacement of the pico sdk timer, the microsecond clock is std::chrono::steady_clock
+// unless a test sets host_clock_us to drive a virtual clock
+#include <chrono>
+#include <cstdint>
+
+inline uint64_t (*host_clock_us)(){};
+
+inline uint64_t time_us_64() {
+	if (host_clock_us)
+		return host_clock_us();
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+inline uint32_t time_us_32() { return static_cast<uint32_t>(time_us_64()); }
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+typedef int8_t err_t;
+
+enum err_enum_t {
+	ERR_OK = 0,
+	ERR_MEM = -1,
+	ERR_VAL = -6,
+	ERR_ABRT = -13,
+	ERR_RST = -14,
+	ERR_CLSD = -15,
+};
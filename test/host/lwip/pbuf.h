@@ -0,0 +1,57 @@
+#pragma once
+
+// Host replacement of the lwip pbuf api, a pbuf and its payload are one heap allocation
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <string_view>
+
+#include "lwip/err.h"
+
+struct pbuf {
+	struct pbuf *next;
+	void *payload;
+	u16_t tot_len;
+	u16_t len;
+};
+
+/** @brief Host only: allocates a single pbuf holding a copy of data */
+inline pbuf* host_pbuf_alloc(std::string_view data) {
+	char *mem = new char[sizeof(pbuf) + data.size()];
+	pbuf *p = new (mem) pbuf{nullptr, mem + sizeof(pbuf), u16_t(data.size()), u16_t(data.size())};
+	std::memcpy(p->payload, data.data(), data.size());
+	return p;
+}
+
+inline u8_t pbuf_free(struct pbuf *p) {
+	u8_t n{};
+	while (p) {
+		pbuf *next = p->next;
+		delete[] reinterpret_cast<char*>(p);
+		p = next;
+		++n;
+	}
+	return n;
+}
+
+inline void pbuf_cat(struct pbuf *head, struct pbuf *tail) {
+	for (; head->next; head = head->next)
+		head->tot_len += tail->tot_len;
+	head->tot_len += tail->tot_len;
+	head->next = tail;
+}
+
+inline u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset) {
+	u16_t copied{};
+	for (; p && copied < len; p = p->next) {
+		if (offset >= p->len) {
+			offset -= p->len;
+			continue;
+		}
+		u16_t n = std::min<u16_t>(p->len - offset, len - copied);
+		std::memcpy(static_cast<char*>(dataptr) + copied, static_cast<const char*>(p->payload) + offset, n);
+		copied += n;
+		offset = 0;
+	}
+	return copied;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "lwip/err.h"
+
+// Host replacement of the lwip system time, advanced by the test
+inline u32_t host_sys_now_ms{};
+inline u32_t sys_now() { return host_sys_now_ms; }
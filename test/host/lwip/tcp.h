@@ -0,0 +1,91 @@
+#pragma once
+
+// Host replacement of the lwip raw tcp api. There is no network: the test plays the remote side with
+// host_tcp_connect(), host_tcp_send() and host_tcp_ack(), everything the server writes is collected in tcp_pcb::out.
+#include <string>
+#include <string_view>
+
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+
+#define TCP_WRITE_FLAG_COPY 0x01
+#define TCP_WRITE_FLAG_MORE 0x02
+#define IPADDR_TYPE_ANY 46U
+#define IP_ANY_TYPE (&host_ip_addr_any)
+
+typedef struct { u32_t addr; } ip_addr_t;
+inline const ip_addr_t host_ip_addr_any{};
+
+typedef err_t (*tcp_accept_fn)(void *arg, struct tcp_pcb *newpcb, err_t err);
+typedef err_t (*tcp_recv_fn)(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
+typedef err_t (*tcp_sent_fn)(void *arg, struct tcp_pcb *tpcb, u16_t len);
+typedef err_t (*tcp_poll_fn)(void *arg, struct tcp_pcb *tpcb);
+typedef void (*tcp_err_fn)(void *arg, err_t err);
+
+struct tcp_pcb {
+	static constexpr u16_t SND_BUF{8 * 1460}; // TCP_SND_BUF of the pico w lwipopts
+
+	void *arg{};
+	tcp_accept_fn accept{};
+	tcp_recv_fn recv{};
+	tcp_sent_fn sent{};
+	tcp_poll_fn poll{};
+	tcp_err_fn err{};
+	u16_t sndbuf{SND_BUF};
+	u32_t recved{}; // bytes the window was opened for with tcp_recved()
+	bool closed{};
+	bool allocated{}; // by tcp_new_ip_type(), freed by tcp_close() like in lwip, client pcbs belong to the test
+	std::string out; // everything written by the server
+};
+
+inline struct tcp_pcb* tcp_new_ip_type(u8_t) { return new tcp_pcb{.allocated = true}; }
+inline void tcp_setprio(struct tcp_pcb*, u8_t) {}
+inline err_t tcp_bind(struct tcp_pcb*, const ip_addr_t*, u16_t) { return ERR_OK; }
+inline struct tcp_pcb* tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t) { return pcb; }
+inline void tcp_arg(struct tcp_pcb *pcb, void *arg) { pcb->arg = arg; }
+inline void tcp_accept(struct tcp_pcb *pcb, tcp_accept_fn f) { pcb->accept = f; }
+inline void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn f) { pcb->recv = f; }
+inline void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn f) { pcb->sent = f; }
+inline void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn f, u8_t) { pcb->poll = f; }
+inline void tcp_err(struct tcp_pcb *pcb, tcp_err_fn f) { pcb->err = f; }
+inline void tcp_recved(struct tcp_pcb *pcb, u16_t len) { pcb->recved += len; }
+inline u16_t tcp_sndbuf(struct tcp_pcb *pcb) { return pcb->sndbuf; }
+inline err_t tcp_output(struct tcp_pcb*) { return ERR_OK; }
+inline err_t tcp_close(struct tcp_pcb *pcb) {
+	pcb->closed = true;
+	if (pcb->allocated)
+		delete pcb;
+	return ERR_OK;
+}
+inline void tcp_abort(struct tcp_pcb *pcb) { pcb->closed = true; }
+
+inline err_t tcp_write(struct tcp_pcb *pcb, const void *data, u16_t len, u8_t) {
+	if (len > pcb->sndbuf)
+		return ERR_MEM;
+	pcb->sndbuf -= len;
+	pcb->out.append(static_cast<const char*>(data), len);
+	return ERR_OK;
+}
+
+/** @brief Host only: a client connects to the listening pcb */
+inline err_t host_tcp_connect(struct tcp_pcb *listener, struct tcp_pcb &client) {
+	client = tcp_pcb{};
+	return listener->accept(listener->arg, &client, ERR_OK);
+}
+
+/** @brief Host only: data of the client arrives in one segment */
+inline err_t host_tcp_send(struct tcp_pcb &client, std::string_view data) {
+	return client.recv(client.arg, &client, host_pbuf_alloc(data), ERR_OK);
+}
+
+/** @brief Host only: the client acknowledges everything written so far */
+inline err_t host_tcp_ack(struct tcp_pcb &client) {
+	u16_t len = tcp_pcb::SND_BUF - client.sndbuf;
+	client.sndbuf = tcp_pcb::SND_BUF;
+	return len && client.sent && !client.closed ? client.sent(client.arg, &client, len): ERR_OK;
+}
+
+/** @brief Host only: the client closes its side of the connection */
+inline err_t host_tcp_close(struct tcp_pcb &client) {
+	return client.recv && !client.closed ? client.recv(client.arg, &client, nullptr, ERR_OK): ERR_OK;
+}
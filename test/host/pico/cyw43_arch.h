@@ -0,0 +1,8 @@
+#pragma once
+
+// Host replacement of the pico w network glue, waiting for lwip work returns immediately
+#include <cstdint>
+
+typedef uint64_t absolute_time_t;
+inline absolute_time_t make_timeout_time_ms(uint32_t ms) { return ms * 1000ull; }
+inline void cyw43_arch_wait_for_work_until(absolute_time_t) {}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+#include <chrono>
+#include <mutex>
+
+// Host replacement of the FreeRTOS mutex
+using SemaphoreHandle_t = std::timed_mutex*;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new std::timed_mutex; }
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks) {
+	if (ticks == portMAX_DELAY) {
+		mutex->lock();
+		return pdTRUE;
+	}
+	return mutex->try_lock_for(std::chrono::milliseconds(ticks)) ? pdTRUE : pdFALSE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex) {
+	mutex->unlock();
+	return pdTRUE;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define taskYIELD() std::this_thread::yield()
+
+// the notification value of a thread
+struct host_task {
+	std::mutex mutex;
+	std::condition_variable cv;
+	uint32_t notifications{};
+};
+using TaskHandle_t = host_task*;
+using TaskFunction_t = void (*)(void*);
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+	thread_local host_task task;
+	return &task;
+}
+
+inline TickType_t xTaskGetTickCount() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void xTaskNotifyGive(TaskHandle_t task) {
+	std::lock_guard lock{task->mutex};
+	++task->notifications;
+	task->cv.notify_one();
+}
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+	xTaskNotifyGive(task);
+	*woken = pdTRUE;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+	host_task &task = *xTaskGetCurrentTaskHandle();
+	std::unique_lock lock{task.mutex};
+	task.cv.wait_for(lock, std::chrono::milliseconds(ticks), [&] { return task.notifications != 0; });
+	uint32_t value = task.notifications;
+	task.notifications = clear ? 0 : value - (value != 0);
+	return value;
+}
+
+// the thread runs detached, the priority and core affinity are ignored
+inline BaseType_t xTaskCreateAffinitySet(TaskFunction_t fn, const char*, uint32_t, void *args, UBaseType_t, UBaseType_t, TaskHandle_t*) {
+	std::thread{fn, args}.detach();
+	return pdPASS;
+}
@@ -0,0 +1,96 @@
+// Stress test of the seqlock snapshot channel with std::threads: one writer publishes
+// snapshots as fast as it can while several readers check that every copy is consistent.
+
+#include "seqlock.h"
+#include "test_util.h"
+
+#include <thread>
+#include <vector>
+
+// larger than a cache line so that torn copies are likely if the protocol is broken
+struct snapshot {
+	uint32_t counter;
+	std::array<uint32_t, 20> payload;
+	uint16_t tail;
+	bool flag;
+};
+
+static snapshot make_snapshot(uint32_t counter) {
+	snapshot s{};
+	s.counter = counter;
+	for (size_t i = 0; i < s.payload.size(); ++i)
+		s.payload[i] = counter * 2654435761u + i;
+	s.tail = static_cast<uint16_t>(counter);
+	s.flag = counter & 1;
+	return s;
+}
+
+static bool consistent(const snapshot &s) {
+	snapshot expected = make_snapshot(s.counter);
+	return s.payload == expected.payload && s.tail == expected.tail && s.flag == expected.flag;
+}
+
+struct reader_result {
+	uint64_t reads{};
+	uint64_t torn{};
+	uint64_t backwards{};
+	uint32_t last{};
+};
+
+static void stress(int readers, uint32_t writes) {
+	seqlock<snapshot> channel{};
+	channel.store(make_snapshot(0));
+	std::atomic<bool> done{};
+	std::vector<reader_result> results(readers);
+	std::vector<std::thread> threads;
+	for (int r = 0; r < readers; ++r)
+		threads.emplace_back([&, r] {
+			reader_result &res = results[r];
+			while (!done.load(std::memory_order_acquire)) {
+				snapshot s = channel.peek();
+				++res.reads;
+				res.torn += !consistent(s);
+				res.backwards += s.counter < res.last;
+				res.last = s.counter;
+			}
+		});
+	for (uint32_t i = 1; i <= writes; ++i)
+		channel.store(make_snapshot(i));
+	done.store(true, std::memory_order_release);
+	for (std::thread &t: threads)
+		t.join();
+
+	uint64_t reads{}, torn{}, backwards{};
+	for (const reader_result &r: results) {
+		reads += r.reads;
+		torn += r.torn;
+		backwards += r.backwards;
+	}
+	std::printf("%d readers, %u writes: %llu reads, %llu torn, %llu out of order\n", readers, writes,
+		(unsigned long long)reads, (unsigned long long)torn, (unsigned long long)backwards);
+	CHECK(reads > 0);
+	CHECK_EQ(torn, 0u);
+	CHECK_EQ(backwards, 0u);
+	CHECK_EQ(channel.peek().counter, writes);
+}
+
+static void test_new_data_flag() {
+	seqlock<snapshot> channel{};
+	CHECK(!channel.has_new());
+	channel.store(make_snapshot(7));
+	CHECK(channel.has_new());
+	CHECK_EQ(channel.peek().counter, 7u);
+	CHECK(channel.has_new());
+	CHECK_EQ(channel.load().counter, 7u);
+	CHECK(!channel.has_new());
+}
+
+int main() {
+	test_new_data_flag();
+	unsigned cores = std::max(2u, std::thread::hardware_concurrency());
+	stress(1, 2000000);
+	stress(std::min(cores - 1, 4u), 2000000);
+	// more threads than cores, readers get preempted in the middle of a copy
+	stress(2 * cores, 500000);
+	return test_result();
+}
@@ -0,0 +1,220 @@
+// Keep-alive behaviour of tcp_server on the host lwip harness (test/host/lwip) and a benchmark of the
+// server side cost per request: requests/s and latency percentiles for persistent, pipelined and
+// one-shot connections. The harness has no network, so the handshake round trips a new connection
+// costs on the wifi link are not part of the numbers, only the work of the server.
+
+#include "pico/cyw43_arch.h"
+#include "tcp_server/tcp_server.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <vector>
+
+using server_t = tcp_server<4, 0>;
+
+// a browser tab polling the ui
+constexpr std::string_view REQUEST_HEADERS{
+	"Host: victron-control.local\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:131.0) Gecko/20100101 Firefox/131.0\r\n"
+	"Accept: */*\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate\r\n"
+	"Referer: http://victron-control.local/\r\n"};
+constexpr std::string_view VE_INFOS_BODY{
+	R"({"dc":{"voltage":52.31,"current_inverting":0.0,"current_charging":12.4},"ac":[{"phase":"L1","state":"charging",)"
+	R"("main_voltage":231.2,"main_current":3.1,"inverter_voltage":231.0,"inverter_current":2.9}],"led":{"on":9,"blink":0},)"
+	R"("status":{"dc_level_allows_inverting":true,"dc_current":12.4,"temp":24.5,"battery_ah":200}})"};
+
+static std::string request(std::string_view path, std::string_view extra_headers = {}, std::string_view version = "HTTP/1.1") {
+	std::string r = std::string("GET ") + std::string(path) + " " + std::string(version) + "\r\n";
+	r += REQUEST_HEADERS;
+	r += extra_headers;
+	r += "\r\n";
+	return r;
+}
+
+static int count(std::string_view s, std::string_view what) {
+	int n{};
+	for (size_t pos = s.find(what); pos != std::string_view::npos; pos = s.find(what, pos + what.size()))
+		++n;
+	return n;
+}
+
+// larger than the send buffer of lwip, queued in several tcp_sent rounds
+static const std::string PAGE(3 * tcp_pcb::SND_BUF, 'p');
+
+static server_t& make_server() {
+	static server_t s{.get_endpoints{
+		server_t::endpoint{{.path_match = true}, "/ve_infos", [](const auto&, auto &res) {
+			res.res_set_status_line(HTTP_VERSION, STATUS_OK);
+			res.res_add_header("Content-Type", "application/json");
+			res.res_add_header("Content-Length", static_format<8>("{}", VE_INFOS_BODY.size()));
+			res.res_write_body(VE_INFOS_BODY);
+		}},
+		server_t::endpoint{{.path_match = true}, "/page", [](const auto&, auto &res) {
+			res.res_set_status_line(HTTP_VERSION, STATUS_OK);
+			res.res_add_header("Content-Length", static_format<8>("{}", PAGE.size()));
+			res.res_set_static_body(PAGE);
+		}},
+		server_t::endpoint{{.path_match = true}, "/time", [](const auto&, auto &res) {
+			res.res_set_status_line(HTTP_VERSION, STATUS_OK);
+			res.res_add_header("Content-Length", "10");
+			res.res_write_body("1729072800");
+		}},
+	}};
+	static bool started{};
+	if (!started) {
+		s.default_endpoint_cb = [](const auto&, auto &res) {
+			res.res_set_status_line(HTTP_VERSION, STATUS_NOT_FOUND);
+			res.res_add_header("Content-Length", "0");
+		};
+		CHECK_EQ(s.start(), ERR_OK);
+		started = true;
+	}
+	return s;
+}
+
+static void test_keep_alive() {
+	server_t &s = make_server();
+	tcp_pcb client{};
+	CHECK_EQ(host_tcp_connect(s.server_pcb, client), ERR_OK);
+	host_tcp_send(client, request("/ve_infos"));
+	CHECK_EQ(count(client.out, "HTTP/1.1 200 OK"), 1);
+	CHECK_EQ(count(client.out, "Connection: keep-alive\r\n"), 1);
+	CHECK_EQ(count(client.out, "Keep-Alive: timeout=15\r\n"), 1);
+	CHECK(client.out.ends_with(VE_INFOS_BODY));
+	CHECK(!client.closed);
+
+	// pipelined requests, one of them split over two segments, are answered in order
+	client.out.clear();
+	std::string pipelined = request("/time") + request("/nope") + request("/ve_infos");
+	host_tcp_send(client, std::string_view{pipelined}.substr(0, pipelined.size() - 20));
+	host_tcp_send(client, std::string_view{pipelined}.substr(pipelined.size() - 20));
+	size_t time = client.out.find("1729072800"), not_found = client.out.find("404 Not Found"), infos = client.out.find(VE_INFOS_BODY);
+	CHECK(time != std::string::npos && not_found != std::string::npos && infos != std::string::npos);
+	CHECK(time < not_found && not_found < infos);
+	CHECK(!client.closed);
+	CHECK_EQ(client.recved, uint32_t(request("/ve_infos").size() + pipelined.size()));
+
+	// idle timeout
+	host_sys_now_ms += (s.idle_timeout_s - 1) * 1000;
+	client.poll(client.arg, &client);
+	CHECK(!client.closed);
+	host_sys_now_ms += 2000;
+	client.poll(client.arg, &client);
+	CHECK(client.closed);
+}
+
+// a request pipelined behind a static body larger than the send buffer is completely recieved (and its pbuf freed)
+// before the body is queued, it has to be answered once the body went out via tcp_sent or the poll retry
+static void test_pipelined_after_static_body() {
+	server_t &s = make_server();
+	for (bool via_poll: {false, true}) {
+		tcp_pcb client{};
+		host_tcp_connect(s.server_pcb, client);
+		host_tcp_send(client, request("/page") + request("/time"));
+		CHECK_EQ(count(client.out, "HTTP/1.1 200 OK"), 1);
+		for (int i = 0; i < 10 && count(client.out, "1729072800") == 0; ++i) {
+			if (via_poll) { // the acks arrived without a tcp_sent callback, eg. the callback hit a full queue
+				client.sndbuf = tcp_pcb::SND_BUF;
+				client.poll(client.arg, &client);
+			} else
+				host_tcp_ack(client);
+		}
+		CHECK_EQ(count(client.out, "HTTP/1.1 200 OK"), 2);
+		CHECK(client.out.find(PAGE) != std::string::npos && client.out.find(PAGE) < client.out.find("1729072800"));
+		CHECK(!client.closed);
+		host_tcp_close(client);
+	}
+}
+
+static void test_close() {
+	server_t &s = make_server();
+	tcp_pcb client{};
+	host_tcp_connect(s.server_pcb, client);
+	host_tcp_send(client, request("/time", "Connection: close\r\n"));
+	CHECK_EQ(count(client.out, "Connection: close\r\n"), 1);
+	CHECK(client.closed);
+
+	// HTTP/1.0 only keeps the connection on request
+	host_tcp_connect(s.server_pcb, client);
+	host_tcp_send(client, request("/time", {}, "HTTP/1.0"));
+	CHECK(client.closed);
+	host_tcp_connect(s.server_pcb, client);
+	host_tcp_send(client, request("/time", "Connection: keep-alive\r\n", "HTTP/1.0"));
+	CHECK(!client.closed);
+	host_tcp_send(client, request("/time", "Connection: close\r\n", "HTTP/1.0"));
+	CHECK(client.closed);
+
+	// the connection is closed with the response to request max_keep_alive_requests
+	host_tcp_connect(s.server_pcb, client);
+	for (int i = 1; i < s.max_keep_alive_requests; ++i)
+		host_tcp_send(client, request("/time"));
+	CHECK(!client.closed);
+	host_tcp_send(client, request("/time"));
+	CHECK_EQ(count(client.out, "HTTP/1.1 200 OK"), s.max_keep_alive_requests);
+	CHECK_EQ(count(client.out, "Connection: close\r\n"), 1);
+	CHECK(client.closed);
+}
+
+struct latencies {
+	std::vector<double> ns; // per request, the mean of its segment for pipelined requests
+
+	void print(const char *name, int requests, double total_ns) {
+		std::sort(ns.begin(), ns.end());
+		auto pct = [&](double p) { return ns[std::min(ns.size() - 1, size_t(p * ns.size()))] / 1000; };
+		std::printf("%-28s %9.0f requests/s, latency p50 %5.2f us, p99 %5.2f us, max %6.2f us\n",
+			name, requests * 1e9 / total_ns, pct(.5), pct(.99), ns.back() / 1000);
+	}
+};
+
+/** @brief Runs n requests of clients (round robin) with requests_per_segment pipelined requests per segment,
+  * a client reconnects when the server closed its connection */
+static void benchmark(const char *name, int n, int clients, int requests_per_segment, std::string_view extra_headers = {}) {
+	server_t &s = make_server();
+	std::vector<tcp_pcb> pcbs(clients);
+	for (tcp_pcb &c: pcbs)
+		host_tcp_connect(s.server_pcb, c);
+	std::string segment;
+	for (int i = 0; i < requests_per_segment; ++i)
+		segment += request(i % 2 ? "/time": "/ve_infos", extra_headers);
+
+	latencies l;
+	int responses{}, connects{};
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < n; i += requests_per_segment) {
+		tcp_pcb &c = pcbs[i / requests_per_segment % clients];
+		auto t0 = std::chrono::steady_clock::now();
+		if (c.closed) {
+			host_tcp_connect(s.server_pcb, c);
+			++connects;
+		}
+		host_tcp_send(c, segment);
+		host_tcp_ack(c);
+		auto t1 = std::chrono::steady_clock::now();
+		l.ns.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count() / requests_per_segment);
+		responses += count(c.out, "HTTP/1.1 ");
+		c.out.clear();
+	}
+	double total = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	l.print(name, n, total);
+	CHECK_EQ(responses, n);
+	if (extra_headers.empty())
+		CHECK(connects <= n / s.max_keep_alive_requests);
+	for (tcp_pcb &c: pcbs)
+		if (!c.closed)
+			host_tcp_close(c);
+}
+
+int main() {
+	test_keep_alive();
+	test_pipelined_after_static_body();
+	test_close();
+	constexpr int N = 50000;
+	benchmark("keep-alive", N, 1, 1);
+	benchmark("keep-alive, 4 tabs", N, 4, 1);
+	benchmark("keep-alive, 4 pipelined", N, 1, 4);
+	benchmark("connection per request", N, 1, 1, "Connection: close\r\n");
+	make_server().stop();
+	return test_result();
+}
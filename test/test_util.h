@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+// Minimal checks for the host tests, a failed check is printed and the test returns test_result() != 0
+inline int test_failures{};
+#define CHECK(cond) do { if (!(cond)) { std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++test_failures; } } while (0)
+#define CHECK_EQ(a, b) do { auto a_ = (a); auto b_ = (b); if (!(a_ == b_)) { \
+	std::printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, (long long)a_, (long long)b_); ++test_failures; } } while (0)
+
+inline int test_result() {
+	if (test_failures)
+		std::printf("%d checks failed\n", test_failures);
+	return test_failures ? 1: 0;
+}
+
+/** @brief Runs f(i) for i in [0, n) and returns the mean wall time per call in ns */
+template<typename F>
+double ns_per_call(uint64_t n, F &&f) {
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < n; ++i)
+		f(i);
+	std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+	return d.count() / n;
+}
+
+// keeps the compiler from optimizing away benchmarked results
+template<typename T>
+void do_not_optimize(const T &v) { asm volatile("" : : "r,m"(v) : "memory"); }
@@ -0,0 +1,216 @@
+// Checks how requests are queued into the data fifo of VEBus. The communication task is not started,
+// the fifo is inspected directly. The bus is the simulator, driven on a virtual clock where needed.
+
+#include "ve_bus.h"
+#include "test_util.h"
+
+#include <thread>
+#include <vector>
+
+static bool contains(const VEBus::Data &data, uint8_t address) {
+	return std::find(data.addresses.begin(), data.addresses.end(), address) != data.addresses.end();
+}
+
+// a read of the first variable of a packed poll read must not replace the packed read
+static void test_read_keeps_packed_read() {
+	Serial serial{};
+	VEBus ve_bus{serial};
+	ve_bus.Poll(UBat, 1000);
+	ve_bus.Poll(IBat, 1000);
+	xSemaphoreTake(ve_bus._semaphoreDataFifo, portMAX_DELAY);
+	VEBus::Data *packed = ve_bus.schedulePoll();
+	xSemaphoreGive(ve_bus._semaphoreDataFifo);
+	CHECK(packed != nullptr);
+	if (!packed)
+		return;
+	CHECK_EQ(packed->addresses.size(), 2);
+	uint8_t first = packed->address;
+	uint8_t packed_id = packed->id;
+	packed->IsSent = true;
+
+	// answered by the pending response of the packed read
+	CHECK_EQ(ve_bus.Read(RamVariables(first)), packed_id);
+	CHECK_EQ(ve_bus._dataFifo.size(), 1);
+	const VEBus::Data &entry = *ve_bus._dataFifo.begin();
+	CHECK_EQ(entry.id, packed_id);
+	CHECK(entry.IsSent);
+	CHECK(contains(entry, UBat) && contains(entry, IBat));
+	CHECK(ve_bus.findFifoEntry(packed_id) == &entry);
+}
+
+// a sent read of the same single variable is still replaced and sent again
+static void test_read_replaces_equal_read() {
+	Serial serial{};
+	VEBus ve_bus{serial};
+	uint8_t id = ve_bus.Read(UBat);
+	CHECK(id != 0);
+	ve_bus._dataFifo.begin()->IsSent = true;
+
+	uint8_t again = ve_bus.Read(UBat);
+	CHECK(again != 0);
+	CHECK(again != id);
+	CHECK_EQ(ve_bus._dataFifo.size(), 1);
+	CHECK(!ve_bus._dataFifo.begin()->IsSent);
+	CHECK(ve_bus.findFifoEntry(id) == nullptr);
+	CHECK(ve_bus.findFifoEntry(again) == ve_bus._dataFifo.begin());
+}
+
+// a read of a variable which is not the first one of a sent packed read gets its own entry
+static void test_read_of_other_variable_is_queued() {
+	Serial serial{};
+	VEBus ve_bus{serial};
+	ve_bus.Poll(UBat, 1000);
+	ve_bus.Poll(IBat, 1000);
+	xSemaphoreTake(ve_bus._semaphoreDataFifo, portMAX_DELAY);
+	VEBus::Data *packed = ve_bus.schedulePoll();
+	xSemaphoreGive(ve_bus._semaphoreDataFifo);
+	CHECK(packed != nullptr);
+	if (!packed)
+		return;
+	packed->IsSent = true;
+	uint8_t packed_id = packed->id;
+	uint8_t other = packed->address == UBat ? IBat: UBat;
+
+	uint8_t id = ve_bus.Read(RamVariables(other));
+	CHECK(id != 0);
+	CHECK(id != packed_id);
+	CHECK_EQ(ve_bus._dataFifo.size(), 2);
+	CHECK_EQ(ve_bus.findFifoEntry(packed_id)->addresses.size(), 2);
+}
+
+struct completion_log {
+	int calls{};
+	VEBus::RequestError error{};
+	static void complete(const VEBus::ResponseData &response, void *user) {
+		completion_log &log = *static_cast<completion_log*>(user);
+		++log.calls;
+		log.error = response.error;
+	}
+	VEBus::Completion completion() { return {complete, this}; }
+};
+
+static i16 power_of(const VEBus::Data &data) {
+	return i16(data.requestData[5] | (data.requestData[6] << 8));
+}
+
+// power writes of a device patch the queued write instead of filling the fifo, completions are superseded
+static void test_power_write_supersedes() {
+	Serial serial{};
+	VEBus ve_bus{serial};
+	completion_log first{}, second{}, third{}, fourth{};
+	VEBus::RequestResult r1 = ve_bus.SetPower(100, first.completion());
+	VEBus::RequestResult r2 = ve_bus.SetPower(200, second.completion());
+	CHECK(r1.error == VEBus::RequestError::Success && r2.error == VEBus::RequestError::Success);
+	CHECK_EQ(r2.id, r1.id);
+	CHECK_EQ(ve_bus._dataFifo.size(), 1);
+	CHECK_EQ(power_of(*ve_bus._dataFifo.begin()), 200);
+	CHECK_EQ(first.calls, 1);
+	CHECK(first.error == VEBus::RequestError::Superseded);
+	CHECK_EQ(second.calls, 0);
+
+	// without a completion only the value changes
+	CHECK_EQ(ve_bus.SetPower(300).id, r1.id);
+	CHECK_EQ(power_of(*ve_bus._dataFifo.begin()), 300);
+	CHECK(ve_bus._dataFifo.begin()->completion.user == &second);
+
+	// a sent write can not be patched anymore, one more write is queued behind it
+	ve_bus._dataFifo.begin()->IsSent = true;
+	VEBus::RequestResult r3 = ve_bus.SetPower(400, third.completion());
+	CHECK(r3.id != r1.id);
+	for (int i = 0; i < 2 * VEBUS_FIFO_SIZE; ++i)
+		ve_bus.SetPower(i16(500 + i), fourth.completion());
+	CHECK_EQ(ve_bus._dataFifo.size(), 2);
+	CHECK_EQ(third.calls, 1);
+	CHECK(third.error == VEBus::RequestError::Superseded);
+	CHECK_EQ(fourth.calls, 2 * VEBUS_FIFO_SIZE - 1);
+	CHECK_EQ(second.calls, 0);
+	CHECK_EQ(power_of(*ve_bus.findFifoEntry(r3.id)), 500 + 2 * VEBUS_FIFO_SIZE - 1);
+}
+
+// tasks which queue requests at the same time never get the same id
+static void test_concurrent_ids() {
+	constexpr int TASKS = 4;
+	for (int round = 0; round < 200; ++round) {
+		Serial serial{};
+		VEBus ve_bus{serial};
+		std::vector<std::thread> tasks;
+		for (int t = 0; t < TASKS; ++t)
+			tasks.emplace_back([&ve_bus, t] {
+				for (int i = 0; i < VEBUS_FIFO_SIZE / TASKS; ++i)
+					ve_bus.Read(Settings(t * VEBUS_FIFO_SIZE / TASKS + i));
+			});
+		for (std::thread &t: tasks)
+			t.join();
+		CHECK_EQ(ve_bus._dataFifo.size(), VEBUS_FIFO_SIZE);
+		for (const VEBus::Data &entry: ve_bus._dataFifo) {
+			CHECK_EQ(entry.requestData[1], entry.id);
+			CHECK(ve_bus.findFifoEntry(entry.id) == &entry);
+		}
+	}
+}
+
+static uint64_t now_us{};
+
+// runs the communication task loop against the simulator for duration_us
+static void run_bus(VEBus &ve_bus, Serial &serial, uint64_t duration_us) {
+	for (uint64_t end = now_us + duration_us; now_us < end; now_us += serial.info.rx_poll_us) {
+		serial.poll();
+		while (ve_bus.commandHandling());
+		ve_bus.checkResponseTimeout();
+	}
+}
+
+static uint32_t samples(const VEBus::QueueWaitHistogram &h) {
+	uint32_t n = 0;
+	for (uint32_t c: h)
+		n += c;
+	return n;
+}
+
+// a realtime request is sent in the next sync slot, a background request queued at the same time waits for the next one.
+// Resends do not count as queue wait
+static void test_queue_wait_histogram() {
+	now_us = 1000000;
+	host_clock_us = [] { return now_us; };
+	Serial::rs485_info info{};
+	info.clock_us = [] { return now_us; };
+	Serial serial{info};
+	VEBus ve_bus{serial};
+	ve_bus.StartCommunication();
+	run_bus(ve_bus, serial, 5000); // just after a sync frame
+
+	ve_bus.ReadInfo(UBat);
+	ve_bus.SetPower(100);
+	run_bus(ve_bus, serial, 3 * info.sync_period_us);
+	const VEBus::QueueWaitHistogram &realtime = ve_bus.GetQueueWaitHistogram(VEBus::Realtime);
+	const VEBus::QueueWaitHistogram &background = ve_bus.GetQueueWaitHistogram(VEBus::Background);
+	CHECK_EQ(samples(realtime), 1u);
+	CHECK_EQ(samples(background), 1u);
+	CHECK_EQ(realtime[1], 1u); // 15 ms until the next sync
+	CHECK_EQ(background[2], 1u); // 35 ms, one sync later
+	CHECK_EQ(samples(ve_bus.GetQueueWaitHistogram(VEBus::Telemetry)), 0u);
+
+	uint8_t id = ve_bus.Read(UBat);
+	run_bus(ve_bus, serial, 3 * info.sync_period_us);
+	const VEBus::QueueWaitHistogram &telemetry = ve_bus.GetQueueWaitHistogram(VEBus::Telemetry);
+	CHECK_EQ(samples(telemetry), 1u);
+	CHECK(ve_bus.findFifoEntry(id) == nullptr);
+	// queued like a resend after a timeout
+	id = ve_bus.Read(UBat);
+	ve_bus._dataFifo.back()->resendCount = 1;
+	ve_bus._dataFifo.back()->sentTimeMs -= VEBUS_RESPONSE_TIMEOUT;
+	run_bus(ve_bus, serial, 3 * info.sync_period_us);
+	CHECK(ve_bus.findFifoEntry(id) == nullptr); // sent and answered
+	CHECK_EQ(samples(telemetry), 1u);
+	host_clock_us = {};
+}
+
+int main() {
+	test_read_keeps_packed_read();
+	test_read_replaces_equal_read();
+	test_read_of_other_variable_is_queued();
+	test_concurrent_ids();
+	test_power_write_supersedes();
+	test_queue_wait_histogram();
+	return test_result();
+}
@@ -0,0 +1,133 @@
+// Compares the single pass VEBusFrameEncoder with the three pass send path it replaced
+// (copy of the request, prefix shift, stuffing, appended checksum): identical frames and throughput.
+
+#include "ve_bus_definition.h"
+#include "ve_bus_frame_encoder.h"
+#include "test_util.h"
+
+#include <random>
+#include <vector>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+using VEBusDefinition::VEBusBuffer;
+
+// the replaced path of VEBus::sendData(). It stuffed after the prefix was inserted and so escaped
+// the data frame marker FE as well, here the payload is stuffed first to produce the fixed frames.
+namespace three_pass
+{
+	void prepareCommand(VEBusBuffer &buffer, uint8_t frameNr) {
+		if (!buffer.resize(buffer.size() + 4))
+			return;
+		for (int i = buffer.size() - 1; i >= 4; --i)
+			buffer[i] = buffer[i - 4];
+		buffer[0] = 0x98;
+		buffer[1] = 0xF7;
+		buffer[2] = 0xFE;
+		buffer[3] = (frameNr + 1) & 0x7F;
+	}
+
+	void stuffingFAtoFF(VEBusBuffer &buffer) {
+		uint32_t fas{};
+		for (uint8_t v: buffer)
+			if (v >= 0xFA)
+				++fas;
+		if (!buffer.resize(buffer.size() + fas))
+			return;
+		for (uint8_t *dst = buffer.back(), *src = dst - fas; src && src >= buffer.begin(); --src) {
+			if (*src >= 0xFA) {
+				*dst-- = 0x70 | (*src & 0x0F);
+				*dst-- = 0xFA;
+			} else
+				*dst-- = *src;
+		}
+	}
+
+	void appendChecksum(VEBusBuffer &buffer) {
+		uint8_t cs = 1;
+		for (int i = 2; i < buffer.size(); i++)
+			cs -= buffer[i];
+		if (cs >= 0xFB) {
+			buffer.push(0xFA);
+			buffer.push(cs - 0xFA);
+		} else
+			buffer.push(cs);
+		buffer.push(0xFF);
+	}
+
+	VEBusBuffer encode(const VEBusBuffer &request, uint8_t frameNr) {
+		VEBusBuffer sendData = request;
+		stuffingFAtoFF(sendData);
+		prepareCommand(sendData, frameNr);
+		appendChecksum(sendData);
+		return sendData;
+	}
+}
+
+static VEBusBuffer random_payload(std::mt19937 &rng, int size, int escape_percent) {
+	VEBusBuffer b{};
+	std::uniform_int_distribution<int> byte(0, 0xF9), escape(0xFA, 0xFF), percent(0, 99);
+	for (int i = 0; i < size; ++i)
+		b.push(percent(rng) < escape_percent ? escape(rng): byte(rng));
+	return b;
+}
+
+static void test_same_frames() {
+	std::mt19937 rng{12};
+	std::array<uint8_t, VEBusFrameEncoder::maxFrameSize(VEBUS_MAX_BUFFER_SIZE)> out;
+	int compared{};
+	for (int i = 0; i < 100000; ++i) {
+		int size = rng() % 40;
+		VEBusBuffer payload = random_payload(rng, size, rng() % 50);
+		uint8_t frameNr = rng() & 0x7F;
+		VEBusBuffer expected = three_pass::encode(payload, frameNr);
+		uint32_t n = VEBusFrameEncoder::encode(payload, frameNr, out);
+		CHECK_EQ(n, uint32_t(expected.size()));
+		if (n == uint32_t(expected.size()) && std::equal(expected.begin(), expected.end(), out.begin()))
+			++compared;
+	}
+	CHECK_EQ(compared, 100000);
+	VEBusBuffer payload = random_payload(rng, 10, 0);
+	CHECK_EQ(VEBusFrameEncoder::encode(payload, 0, std::span{out}.first(VEBusFrameEncoder::maxFrameSize(10) - 1)), 0u);
+	CHECK(VEBusFrameEncoder::encode(payload, 0, std::span{out}.first(VEBusFrameEncoder::maxFrameSize(10))) > 0);
+}
+
+// mean cycles (x86 time stamp counter) per call, 0 elsewhere
+template<typename F>
+double cycles_per_call(uint64_t n, F &&f) {
+#if defined(__x86_64__)
+	uint64_t start = __rdtsc();
+	for (uint64_t i = 0; i < n; ++i)
+		f(i);
+	return double(__rdtsc() - start) / n;
+#else
+	return 0;
+#endif
+}
+
+static void benchmark(const char *name, const VEBusBuffer &payload) {
+	constexpr uint64_t N = 2000000;
+	std::array<uint8_t, VEBusFrameEncoder::maxFrameSize(VEBUS_MAX_BUFFER_SIZE)> out;
+	uint32_t frame_size = VEBusFrameEncoder::encode(payload, 0, out);
+	auto old_path = [&](uint64_t i) { VEBusBuffer b = three_pass::encode(payload, i); do_not_optimize(b); };
+	auto new_path = [&](uint64_t i) { do_not_optimize(VEBusFrameEncoder::encode(payload, i, out)); do_not_optimize(out); };
+	double ns_old = ns_per_call(N, old_path), ns_new = ns_per_call(N, new_path);
+	double cy_old = cycles_per_call(N, old_path), cy_new = cycles_per_call(N, new_path);
+	std::printf("%-28s %3d -> %3u bytes: three pass %6.1f ns %6.1f cycles (%.2f bytes/cycle), single pass %6.1f ns %6.1f cycles (%.2f bytes/cycle)\n",
+		name, payload.size(), frame_size, ns_old, cy_old, cy_old ? frame_size / cy_old: 0, ns_new, cy_new, cy_new ? frame_size / cy_new: 0);
+}
+
+int main() {
+	test_same_frames();
+	std::mt19937 rng{7};
+	// 00 <id> WriteViaID <type> <address> <low> <high>, the usual request
+	VEBusBuffer write_request{};
+	for (uint8_t b: {0x00, 0x85, 0x32, 0x02, 0x83, 0xE8, 0x03})
+		write_request.push(b);
+	benchmark("write request", write_request);
+	benchmark("60 bytes, no escapes", random_payload(rng, 60, 0));
+	benchmark("60 bytes, 10% escapes", random_payload(rng, 60, 10));
+	benchmark("60 bytes, all escaped", random_payload(rng, 60, 100));
+	return test_result();
+}
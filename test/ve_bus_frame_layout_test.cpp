@@ -0,0 +1,142 @@
+// Decodes captured and hand built VE.Bus frames with the layout tables of ve_bus_frame_layout.h and
+// compares the result with the byte arithmetic the driver used before the tables existed.
+
+#include "ve_bus_frame_layout.h"
+#include "test_util.h"
+
+#include <cmath>
+
+using namespace VEBusFrameLayout;
+
+// same dispatch as VEBus::decodeVEbusFrame()
+struct Entry { const Frame *layout; };
+constexpr std::array<Entry, 6> entries{Entry{&Response::frame}, {&InfoFrame::frame}, {&MasterMultiLed::frame},
+                                       {&BatteryCondition::frame}, {&ChargerInverterCondition::frame}, {&AcPhaseInformation::frame}};
+constexpr std::array<uint8_t, 256> dispatch = make_dispatch(entries);
+
+// returns the index of the matching layout or NO_FRAME
+static uint8_t classify(std::span<const uint8_t> frame) {
+	uint8_t idx = dispatch[frame[4]];
+	if (idx == NO_FRAME || !(*entries[idx].layout)(frame))
+		return NO_FRAME;
+	return idx;
+}
+
+static int16_t le16(std::span<const uint8_t> b, int o) { return int16_t(b[o + 1] << 8 | b[o]); }
+static int32_t le24(std::span<const uint8_t> b, int o) { return int32_t(uint32_t(b[o] | b[o + 1] << 8 | b[o + 2] << 16) << 8) >> 8; }
+
+static void test_info_frame_ac() {
+	constexpr std::array<uint8_t, 21> f{0x83, 0x83, 0xFE, 0x1B, 0x20, 0x01, 0x01, 0x00, 0x04, 0x08, 0x00,
+	                                    0x00, 0x00, 0x00, 0xC6, 0x59, 0x1E, 0x00, 0x00, 0x7D, 0xFF};
+	CHECK_EQ(classify(f), 1);
+	CHECK_EQ(InfoFrame::Phase.raw(f), PhaseInfo::S_L1);
+	CHECK_EQ(InfoFrame::State.raw(f), 0x04);
+	CHECK_EQ(InfoFrame::MainVoltage.raw(f), le16(f, 10));
+	CHECK_EQ(InfoFrame::MainCurrent.raw(f), le16(f, 12));
+	CHECK_EQ(InfoFrame::InverterVoltage.raw(f), 0x59C6);
+	CHECK_EQ(InfoFrame::InverterVoltage.raw(f), le16(f, 14));
+	CHECK_EQ(InfoFrame::InverterCurrent.raw(f), 0x1E);
+	CHECK_EQ(f[InfoFrame::MainCurrent.factor_offset], f[5]);
+	CHECK_EQ(f[InfoFrame::InverterCurrent.factor_offset], f[6]);
+	// the driver accepts info frames from 20 bytes on
+	CHECK_EQ(classify(std::span{f}.first(20)), 1);
+	CHECK_EQ(classify(std::span{f}.first(19)), NO_FRAME);
+}
+
+static void test_info_frame_dc() {
+	constexpr std::array<uint8_t, 21> f{0x83, 0x83, 0xFE, 0x72, 0x20, 0x40, 0xA5, 0xC4, 0x01, 0x0C, 0x33,
+	                                    0x05, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, 0x86, 0xEB, 0xFF};
+	CHECK_EQ(classify(f), 1);
+	CHECK_EQ(InfoFrame::Phase.raw(f), PhaseInfo::DC);
+	CHECK_EQ(InfoFrame::DcVoltage.raw(f), 0x0533);
+	CHECK_EQ(InfoFrame::DcVoltage.raw(f), le16(f, 10));
+	CHECK_EQ(InfoFrame::DcCurrentInverting.raw(f), 0x12);
+	CHECK_EQ(InfoFrame::DcCurrentCharging.raw(f), 0);
+
+	// negative 24 bit currents are sign extended
+	std::array<uint8_t, 21> n = f;
+	n[12] = 0xFE; n[13] = 0xFF; n[14] = 0xFF;
+	n[15] = 0x00; n[16] = 0x00; n[17] = 0x80;
+	CHECK_EQ(InfoFrame::DcCurrentInverting.raw(n), -2);
+	CHECK_EQ(InfoFrame::DcCurrentInverting.raw(n), le24(n, 12));
+	CHECK_EQ(InfoFrame::DcCurrentCharging.raw(n), -0x800000);
+	CHECK_EQ(InfoFrame::DcCurrentCharging.raw(n), le24(n, 15));
+}
+
+static void test_master_multi_led() {
+	std::array<uint8_t, 19> f{0x83, 0x83, 0xFE, 0x10, 0x41, 0x10, 0x09, 0x01, 0x02, 0x05,
+	                          0x20, 0x00, 0xF4, 0x01, 0xA0, 0x00, 0x08, 0x00, 0xFF};
+	CHECK_EQ(classify(f), 2);
+	CHECK_EQ(MasterMultiLed::LEDon.raw(f), 0x09);
+	CHECK_EQ(MasterMultiLed::LEDblink.raw(f), 0x01);
+	CHECK(MasterMultiLed::LowBattery(f));
+	CHECK_EQ(MasterMultiLed::AcInputConfiguration.raw(f), 0x05);
+	CHECK(MasterMultiLed::MinimumInputCurrentLimitA.value(f) == le16(f, 10) / 10.0f);
+	CHECK(MasterMultiLed::MaximumInputCurrentLimitA.value(f) == le16(f, 12) / 10.0f);
+	CHECK(MasterMultiLed::ActualInputCurrentLimitA.value(f) == le16(f, 14) / 10.0f);
+	CHECK_EQ(MasterMultiLed::SwitchRegister.raw(f), 0x08);
+	f[5] = 0x11;
+	CHECK_EQ(classify(f), NO_FRAME);
+}
+
+static void test_battery_condition() {
+	std::array<uint8_t, 15> f{0x83, 0x83, 0xFE, 0x11, 0x70, 0x81, 0x64, 0x14, 0xBC, 0x02, 0xC8, 0x00, 0x00, 0x00, 0xFF};
+	CHECK_EQ(classify(f), 3);
+	CHECK_EQ(BatteryCondition::BatterieAh.raw(f), 200);
+	for (uint8_t offset: {5, 6, 7, 8, 9, 12}) {
+		std::array<uint8_t, 15> g = f;
+		g[offset] ^= 0x01;
+		CHECK_EQ(classify(g), NO_FRAME);
+	}
+	CHECK_EQ(classify(std::span{f}.first(14)), NO_FRAME);
+}
+
+static void test_charger_inverter_condition() {
+	std::array<uint8_t, 19> f{0x83, 0x83, 0xFE, 0x12, 0x80, 0x80, 0x13, 0x02, 0x80, 0x9C,
+	                          0xFF, 0x30, 0x00, 0x00, 0x00, 0xC8, 0x00, 0x00, 0xFF};
+	CHECK_EQ(classify(f), 4);
+	CHECK(ChargerInverterCondition::LowBattery(f));
+	CHECK(ChargerInverterCondition::DcLevelAllowsInverting(f));
+	CHECK(ChargerInverterCondition::DcCurrentA.value(f) == le16(f, 9) / 10.0f);
+	CHECK(ChargerInverterCondition::TempAvailable(f));
+	CHECK(ChargerInverterCondition::Temp.value(f) == f[15] / 10.0f);
+	f[6] = 0x12; // bit 0 is the inverting flag, not part of the match
+	CHECK_EQ(classify(f), 4);
+	CHECK(!ChargerInverterCondition::DcLevelAllowsInverting(f));
+	f[11] = 0x20;
+	CHECK_EQ(classify(f), NO_FRAME);
+}
+
+static void test_ac_phase_information() {
+	std::array<uint8_t, 21> f{0x83, 0x83, 0xFE, 0x13, 0xE4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	                          0x00, 0x00, 0x00, 0x00, 0x00, 0x5C, 0xFA, 0x00, 0x00, 0xFF};
+	CHECK_EQ(classify(f), 5);
+	CHECK_EQ(AcPhaseInformation::DcVoltage.raw(f), ((f[17] & 0x0F) << 8) + f[16]);
+	CHECK(std::abs(AcPhaseInformation::DcVoltage.value(f) - 0xA5C / 50.0f) < 1e-4f);
+	CHECK_EQ(classify(std::span{f}.first(20)), NO_FRAME);
+}
+
+static void test_dispatch() {
+	// responses of all devices share one layout
+	for (uint8_t t = 0; t < VEBUS_DEVICE_COUNT; ++t)
+		CHECK_EQ(dispatch[t], 0);
+	CHECK_EQ(dispatch[VEBUS_DEVICE_COUNT], NO_FRAME);
+	std::array<uint8_t, 8> response{0x83, 0x83, 0xFE, 0x14, 0x00, 0x85, 0x85, 0xFF};
+	CHECK_EQ(classify(response), 0);
+	CHECK_EQ(Response::Id.raw(response), 0x85);
+	int handled{};
+	for (uint8_t idx: dispatch)
+		handled += idx != NO_FRAME;
+	CHECK_EQ(handled, VEBUS_DEVICE_COUNT + 5);
+}
+
+int main() {
+	test_info_frame_ac();
+	test_info_frame_dc();
+	test_master_multi_led();
+	test_battery_condition();
+	test_charger_inverter_condition();
+	test_ac_phase_information();
+	test_dispatch();
+	return test_result();
+}
@@ -0,0 +1,180 @@
+// Fuzz tests of VEBusFrameReceiver: encoder -> receiver round trips, random streams and bit flipped
+// frame streams. Corrupt frames have to be rejected and the following frames received unchanged.
+
+#include "ve_bus_frame_encoder.h"
+#include "ve_bus_frame_receiver.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using Receiver = VEBusFrameReceiver<128>;
+using Frame = std::vector<uint8_t>;
+
+static std::vector<uint8_t> random_payload(std::mt19937 &rng, int size, int escape_percent) {
+	std::vector<uint8_t> p;
+	std::uniform_int_distribution<int> byte(0, 0xF9), escape(0xFA, 0xFF), percent(0, 99);
+	for (int i = 0; i < size; ++i)
+		p.push_back(percent(rng) < escape_percent ? escape(rng): byte(rng));
+	return p;
+}
+
+static std::vector<uint8_t> encode(std::span<const uint8_t> payload, uint8_t frameNr) {
+	std::vector<uint8_t> out(VEBusFrameEncoder::maxFrameSize(payload.size()));
+	out.resize(VEBusFrameEncoder::encode(payload, frameNr, out));
+	return out;
+}
+
+// pushes the stream, returns the complete frames and counts the rejected ones
+static std::vector<Frame> receive(Receiver &receiver, std::span<const uint8_t> stream, uint32_t *rejected = nullptr) {
+	std::vector<Frame> frames;
+	for (uint8_t b: stream) {
+		Receiver::Result r = receiver.push(b);
+		if (r == Receiver::Complete)
+			frames.emplace_back(receiver.frame().begin(), receiver.frame().end());
+		else if (r != Receiver::Pending && rejected)
+			++*rejected;
+		CHECK(receiver.size < 128);
+	}
+	return frames;
+}
+
+static void test_round_trip() {
+	std::mt19937 rng{16};
+	Receiver receiver{};
+	receiver.push(0xFF); // sync the receiver
+	int escaped_checksums{}, escapes{};
+	for (int i = 0; i < 200000; ++i) {
+		std::vector<uint8_t> payload = random_payload(rng, 1 + rng() % 56, rng() % 40);
+		uint8_t frameNr = rng() & 0x7F;
+		std::vector<uint8_t> stream = encode(payload, frameNr);
+		escaped_checksums += stream[stream.size() - 3] == 0xFA;
+		escapes += std::count_if(payload.begin(), payload.end(), [](uint8_t v) { return v >= 0xFA; });
+		uint32_t rejected{};
+		std::vector<Frame> frames = receive(receiver, stream, &rejected);
+		CHECK_EQ(rejected, 0u);
+		CHECK_EQ(frames.size(), 1u);
+		if (frames.size() != 1)
+			continue;
+		const Frame &f = frames[0];
+		// 98 F7 FE <nr> <payload> <checksum> FF
+		CHECK_EQ(f.size(), payload.size() + 6);
+		CHECK_EQ(f[2], 0xFE);
+		CHECK_EQ(f[3], (frameNr + 1) & 0x7F);
+		CHECK(std::equal(payload.begin(), payload.end(), f.begin() + 4));
+		CHECK_EQ(f.back(), 0xFF);
+	}
+	std::printf("round trip: 200000 frames, %d escaped payload bytes, %d escaped checksums\n", escapes, escaped_checksums);
+	CHECK(escaped_checksums > 0);
+}
+
+// every frame the receiver accepts from random bytes has to carry a valid checksum, nothing may overflow
+static void test_random_stream() {
+	std::mt19937 rng{1};
+	Receiver receiver{};
+	uint32_t rejected{}, accepted{};
+	for (int i = 0; i < 2000000; ++i) {
+		uint8_t b = rng();
+		// more delimiters and escapes than uniform random bytes would have
+		if (rng() % 16 == 0)
+			b = rng() % 2 ? 0xFF: 0xFA;
+		Receiver::Result r = receiver.push(b);
+		rejected += r != Receiver::Complete && r != Receiver::Pending;
+		if (r == Receiver::Complete) {
+			++accepted;
+			std::span<uint8_t> f = receiver.frame();
+			CHECK(f.size() >= Receiver::MIN_FRAME_SIZE);
+			CHECK_EQ(f.back(), 0xFF);
+		}
+	}
+	// a valid frame right after the garbage is received unchanged
+	std::vector<uint8_t> payload{0x00, 0x81, 0x32, 0xFB, 0x10};
+	std::vector<uint8_t> stream = encode(payload, 3);
+	stream.insert(stream.begin(), 0xFF);
+	std::vector<Frame> frames = receive(receiver, stream);
+	CHECK_EQ(frames.size(), 1u);
+	if (frames.size() == 1)
+		CHECK(std::equal(payload.begin(), payload.end(), frames[0].begin() + 4));
+	std::printf("random stream: 2000000 bytes, %u frames rejected, %u accepted by chance\n", rejected, accepted);
+}
+
+// a frame without end of frame longer than the buffer is dropped, the next one is received
+static void test_overflow() {
+	Receiver receiver{};
+	receiver.push(0xFF);
+	std::vector<uint8_t> stream(300, 0x11);
+	uint32_t rejected{};
+	std::vector<Frame> frames = receive(receiver, stream, &rejected);
+	CHECK_EQ(rejected, 1u);
+	CHECK(frames.empty());
+	std::vector<uint8_t> payload{0x00, 0x82, 0x30};
+	stream = encode(payload, 9);
+	stream.insert(stream.begin(), 0xFF); // ends the overlong frame
+	frames = receive(receiver, stream, &rejected);
+	CHECK_EQ(frames.size(), 1u);
+}
+
+// flips a single bit in one frame of a stream: that frame (and the next one if its end of frame got lost)
+// is rejected, all other frames are received unchanged
+static void test_bit_flips() {
+	std::mt19937 rng{5};
+	constexpr int FRAMES = 16;
+	uint32_t flips{}, detected{}, accepted_corrupt{}, corrupt_address{}, lost{};
+	for (int trial = 0; trial < 20000; ++trial) {
+		std::vector<uint8_t> stream{0xFF};
+		std::vector<size_t> starts;
+		std::vector<Frame> expected;
+		Receiver clean{};
+		clean.push(0xFF);
+		for (int i = 0; i < FRAMES; ++i) {
+			std::vector<uint8_t> payload = random_payload(rng, 2 + rng() % 30, 15);
+			std::vector<uint8_t> frame = encode(payload, i);
+			starts.push_back(stream.size());
+			stream.insert(stream.end(), frame.begin(), frame.end());
+			std::vector<Frame> f = receive(clean, frame);
+			expected.push_back(f.empty() ? Frame{}: f[0]);
+		}
+		starts.push_back(stream.size());
+
+		int k = 1 + rng() % (FRAMES - 2);
+		size_t pos = starts[k] + rng() % (starts[k + 1] - starts[k]);
+		stream[pos] ^= 1u << (rng() % 8);
+		++flips;
+
+		Receiver receiver{};
+		uint32_t rejected{};
+		std::vector<Frame> frames = receive(receiver, stream, &rejected);
+		detected += rejected > 0;
+		// the address is not covered by the checksum, decodeVEbusFrame drops frames from unknown addresses
+		for (const Frame &f: frames)
+			if (std::find(expected.begin(), expected.end(), f) == expected.end())
+				++(f[0] == 0x98 && f[1] == 0xF7 ? accepted_corrupt: corrupt_address);
+		// all frames except the flipped one and the one behind it are received in order
+		size_t next = 0;
+		for (int i = 0; i < FRAMES; ++i) {
+			if (i == k || i == k + 1)
+				continue;
+			while (next < frames.size() && frames[next] != expected[i])
+				++next;
+			if (next == frames.size()) {
+				++lost;
+				break;
+			}
+			++next;
+		}
+	}
+	std::printf("bit flips: %u flipped frames, %u with a rejected frame, %u with a corrupt address, %u corrupt frames accepted, "
+		"%u intact frames lost\n", flips, detected, corrupt_address, accepted_corrupt, lost);
+	CHECK_EQ(lost, 0u);
+	// a flip that splits a frame in two leaves a 1/256 chance for a valid checksum of the first part
+	CHECK(accepted_corrupt * 100 < flips);
+}
+
+int main() {
+	test_round_trip();
+	test_random_stream();
+	test_overflow();
+	test_bit_flips();
+	return test_result();
+}
@@ -0,0 +1,80 @@
+// Replays the byte stream of the simulated MultiPlus at full bus rate through the receive path of the driver
+// (frame callback -> rx_contiguous() -> VEBusFrameReceiver -> rx_consume()) on a virtual clock.
+// The reader is stalled regularly like the VE.Bus task during wifi bursts, no frame may get lost.
+
+#include "ve_bus_simulator.h"
+#include "ve_bus_frame_receiver.h"
+#include "test_util.h"
+
+static uint64_t now_us{};
+static bool frame_notified{};
+
+struct replay_result {
+	uint32_t frames{};
+	uint32_t errors{};
+};
+
+// the same loop as VEBus::receiveFrame(), but all frames are drained
+static replay_result drain(ve_bus_simulator &sim, VEBusFrameReceiver<128> &receiver) {
+	using Receiver = VEBusFrameReceiver<128>;
+	replay_result r{};
+	for (std::span<uint8_t> bytes = sim.rx_contiguous(); !bytes.empty(); bytes = sim.rx_contiguous()) {
+		uint32_t used = 0;
+		for (; used < bytes.size(); ++used) {
+			Receiver::Result result = receiver.push(bytes[used]);
+			r.frames += result == Receiver::Complete;
+			r.errors += result != Receiver::Complete && result != Receiver::Pending;
+		}
+		sim.rx_consume(used);
+	}
+	return r;
+}
+
+/** @brief Runs the simulation for duration_us, the reader does not run for stall_us every stall_period_us */
+static void replay(uint32_t sync_period_us, uint32_t status_offset_us, uint64_t duration_us, uint32_t stall_period_us, uint32_t stall_us) {
+	now_us = 0;
+	frame_notified = false;
+	ve_bus_simulator::rs485_info info{};
+	info.sync_period_us = sync_period_us;
+	info.status_offset_us = status_offset_us;
+	info.clock_us = [] { return now_us; };
+	ve_bus_simulator sim{info};
+	sim.register_on_frame_callback(0xFF, [] { frame_notified = true; });
+	VEBusFrameReceiver<128> receiver{};
+
+	replay_result total{};
+	// one more stall free cycle at the end to pick up the remaining frames, frames_sent only counts complete frames
+	for (uint64_t end = duration_us + sync_period_us; now_us < end; now_us += info.rx_poll_us) {
+		sim.poll();
+		if (now_us < duration_us && stall_period_us && now_us % stall_period_us < stall_us)
+			continue;
+		if (!frame_notified)
+			continue;
+		frame_notified = false;
+		replay_result r = drain(sim, receiver);
+		total.frames += r.frames;
+		total.errors += r.errors;
+	}
+	uint32_t sync_frames = duration_us / sync_period_us;
+
+	double load = double(sim.stats.bytes_sent) * sim.byte_time_us() / now_us;
+	std::printf("sync period %5u us, stall %5u/%6u us: %6u frames sent, %6u received, %u errors, %u overruns, bus load %.0f%%, "
+		"frame latency avg %llu us max %u us\n",
+		sync_period_us, stall_us, stall_period_us, sim.stats.frames_sent, total.frames, total.errors, sim.rx_overruns, load * 100,
+		(unsigned long long)(sim.stats.frames_processed ? sim.stats.frame_latency_us_sum / sim.stats.frames_processed: 0), sim.stats.frame_latency_us_max);
+	CHECK(sim.stats.frames_sent >= 2 * sync_frames); // sync + status frame per cycle
+	CHECK_EQ(total.frames, sim.stats.frames_sent - 1); // the receiver starts hunting, so the first frame is skipped
+	CHECK_EQ(total.errors, 0u);
+	CHECK_EQ(sim.rx_overruns, 0u);
+}
+
+int main() {
+	// nominal cycle of the MultiPlus
+	replay(20000, 4000, 10000000, 0, 0);
+	// full bus rate: the status frame follows the sync frame directly and ends right before the next sync frame
+	replay(1300, 400, 10000000, 0, 0);
+	// reader stalls up to 4 ms at full bus rate, the 256 byte ring holds ~10 ms
+	replay(1300, 400, 10000000, 50000, 4000);
+	replay(1300, 400, 10000000, 7000, 4000);
+	return test_result();
+}
@@ -0,0 +1,147 @@
+// Checks the request id table of the VE.Bus data fifo and benchmarks the worst case of id allocation
+// and response matching with a full fifo against the linear fifo scans it replaced.
+
+#include "ve_bus_request_ids.h"
+#include "VEBusConfig.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <vector>
+
+constexpr bool reserved(uint8_t id) { return id >= 0xE4 && id <= 0xE7; }
+
+// the replaced allocation: try the ids after the last one and scan the whole fifo for each
+// (with the reserved ids skipped, which the old code did not do)
+struct linear_ids {
+	std::vector<uint8_t> fifo;
+	uint8_t last{0x7F};
+
+	bool next_free(uint8_t &id) {
+		for (int i = 0; i < 128; ++i) {
+			uint8_t candidate = ++last < 0x80 ? last = 0x80: last;
+			if (reserved(candidate))
+				continue;
+			if (std::find(fifo.begin(), fifo.end(), candidate) == fifo.end()) {
+				id = candidate;
+				return true;
+			}
+		}
+		return false;
+	}
+	int find(uint8_t id) const {
+		auto it = std::find(fifo.begin(), fifo.end(), id);
+		return it == fifo.end() ? -1: int(it - fifo.begin());
+	}
+};
+
+static void test_allocation() {
+	ve_bus_request_ids ids{};
+	uint8_t id{};
+	std::vector<uint8_t> handed_out;
+	while (ids.next_free(id)) {
+		CHECK(id >= 0x80);
+		CHECK(!reserved(id));
+		CHECK_EQ(ids.find(id), -1);
+		ids.set(id, handed_out.size() & 0xFF);
+		handed_out.push_back(id);
+	}
+	CHECK_EQ(handed_out.size(), 124u);
+	CHECK(std::is_sorted(handed_out.begin(), handed_out.end()));
+	for (size_t i = 0; i < handed_out.size(); ++i)
+		CHECK_EQ(ids.find(handed_out[i]), int(i & 0xFF));
+
+	// round robin: a released id is only reused after the ones behind the last id
+	ids.release(0x90);
+	ids.release(0x85);
+	CHECK_EQ(ids.find(0x90), -1);
+	CHECK(ids.next_free(id));
+	CHECK_EQ(id, 0x85);
+	ids.set(id, 0);
+	CHECK(ids.next_free(id));
+	CHECK_EQ(id, 0x90);
+	ids.set(id, 1);
+	CHECK(!ids.next_free(id));
+
+	// ids below 0x80 are not tracked
+	ids.set(0x10, 3);
+	CHECK_EQ(ids.find(0x10), -1);
+}
+
+// fifo swap-pop removal like VEBus::removeFifoEntry, the table has to follow the moved entry
+static void test_swap_pop() {
+	ve_bus_request_ids ids{};
+	std::vector<uint8_t> fifo;
+	uint8_t id{};
+	for (int i = 0; i < VEBUS_FIFO_SIZE; ++i) {
+		CHECK(ids.next_free(id));
+		ids.set(id, fifo.size());
+		fifo.push_back(id);
+	}
+	for (int idx: {3, 0, 7, 2}) {
+		ids.release(fifo[idx]);
+		if (idx != int(fifo.size()) - 1) {
+			fifo[idx] = fifo.back();
+			ids.set(fifo[idx], idx);
+		}
+		fifo.pop_back();
+		for (size_t i = 0; i < fifo.size(); ++i)
+			CHECK_EQ(ids.find(fifo[i]), int(i));
+	}
+}
+
+static void benchmark() {
+	constexpr uint64_t N = 2000000;
+	ve_bus_request_ids ids{};
+	linear_ids linear{};
+	// worst case of the linear scan: the full fifo holds the ids right after the last one,
+	// every one of them is compared with every fifo entry before a free id is found
+	for (int i = 0; i < VEBUS_FIFO_SIZE; ++i) {
+		uint8_t id = 0x81 + i;
+		ids.set(id, i);
+		linear.fifo.push_back(id);
+	}
+	double t_linear = ns_per_call(N, [&](uint64_t) {
+		uint8_t id{};
+		linear.last = 0x80;
+		do_not_optimize(linear.next_free(id));
+		do_not_optimize(id);
+	});
+	double t_table = ns_per_call(N, [&](uint64_t) {
+		uint8_t id{};
+		ids.last = 0x80;
+		do_not_optimize(ids.next_free(id));
+		do_not_optimize(id);
+	});
+	std::printf("allocation with a full fifo (%d entries): linear scan %.1f ns, id table %.1f ns\n", VEBUS_FIFO_SIZE, t_linear, t_table);
+
+	// worst case of the table: the only free id is in the word before the last id, all words are visited
+	ve_bus_request_ids full{};
+	for (int id = 0x80; id <= 0xFF; ++id)
+		if (id != 0x9F)
+			full.set(id, 0);
+	double t_full = ns_per_call(N, [&](uint64_t) {
+		uint8_t id{};
+		full.last = 0xA0;
+		do_not_optimize(full.next_free(id));
+		do_not_optimize(id);
+	});
+	std::printf("allocation with one free id left: id table %.1f ns\n", t_full);
+
+	// response matching: the response to the last fifo entry
+	uint8_t last_id = linear.fifo.back();
+	double t_find_linear = ns_per_call(N, [&](uint64_t) { do_not_optimize(linear.find(last_id)); });
+	double t_find_table = ns_per_call(N, [&](uint64_t) { do_not_optimize(ids.find(last_id)); });
+	std::printf("response matching: linear scan %.1f ns, id table %.1f ns\n", t_find_linear, t_find_table);
+
+	uint8_t id{};
+	full.last = 0xA0;
+	CHECK(full.next_free(id));
+	CHECK_EQ(id, 0x9F);
+}
+
+int main() {
+	test_allocation();
+	test_swap_pop();
+	benchmark();
+	return test_result();
+}